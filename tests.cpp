@@ -4,8 +4,20 @@
 #include <cmath>
 #include <random>
 #include <memory>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <unordered_map>
 #include <conio.h> // For _getch()
 
 // Constants for game settings (copied from main.cpp)
@@ -19,6 +31,9 @@ const int BOSS_HEALTH = 150;
 const float PLAYER_SHOOT_COOLDOWN = 0.3f;
 const float ENEMY_SHOOT_COOLDOWN = 1.5f;
 const float PROJECTILE_SPEED = 400.0f;
+const int ENEMY_POOL_SIZE = 256;
+const int MAX_ROOM_ENEMIES = 128;
+const float AI_LOD_STEP = 0.1f;
 
 // Enum for direction
 enum Direction {
@@ -28,6 +43,21 @@ enum Direction {
     LEFT
 };
 
+// Status effect types (copied from main.cpp)
+enum StatusType {
+    STATUS_BURN,
+    STATUS_SLOW,
+    STATUS_STUN,
+    STATUS_VULNERABLE,
+    STATUS_COUNT,
+    STATUS_NONE = STATUS_COUNT
+};
+
+// Status names, strengths and colors (copied from main.cpp)
+const char* const STATUS_NAMES[STATUS_COUNT + 1] = { "BURN", "SLOW", "STUN", "VULNERABLE", "NONE" };
+const float STATUS_MAGNITUDE[STATUS_COUNT] = { 8.0f, 0.5f, 1.0f, 0.5f };
+const Color STATUS_COLORS[STATUS_COUNT] = { ORANGE, SKYBLUE, YELLOW, PINK };
+
 // Base Entity struct that all game objects inherit from
 struct Entity {
     float x;
@@ -38,6 +68,10 @@ struct Entity {
     bool active;
     Color color;
     Direction facing;
+    int statusIds[STATUS_COUNT];  // Status effect id per type, -1 if none
+    float speedScale;             // Movement multiplier from slows and stuns
+    float damageScale;            // Damage taken multiplier from vulnerability
+    bool stunned;
     
     // Constructor
     Entity(float startX, float startY, float r, int hp, Color c) {
@@ -49,8 +83,12 @@ struct Entity {
         active = true;
         color = c;
         facing = RIGHT;
+        ClearStatus();
     }
     
+    // Virtual destructor (bosses are deleted through Enemy pointers)
+    virtual ~Entity() {}
+    
     // Basic drawing function
     virtual void Draw() const {
         if (active) {
@@ -61,12 +99,38 @@ struct Entity {
                 DrawRectangle(x - radius, y - radius - 10, 2 * radius, 5, RED);
                 DrawRectangle(x - radius, y - radius - 10, 2 * radius * health / maxHealth, 5, GREEN);
             }
+            DrawStatus();
+        }
+    }
+    
+    // Draw a ring in the color of the first active status effect
+    void DrawStatus() const {
+        for (int t = 0; t < STATUS_COUNT; t++) {
+            if (statusIds[t] >= 0) {
+                DrawCircleLines(x, y, radius + 3, STATUS_COLORS[t]);
+                return;
+            }
         }
     }
     
-    // Function to take damage
+    // Forget all status effects and their modifiers
+    void ClearStatus() {
+        for (int t = 0; t < STATUS_COUNT; t++) {
+            statusIds[t] = -1;
+        }
+        ResetStatusModifiers();
+    }
+    
+    // Return the status modifiers to their neutral values
+    void ResetStatusModifiers() {
+        speedScale = 1.0f;
+        damageScale = 1.0f;
+        stunned = false;
+    }
+    
+    // Function to take damage (scaled up while vulnerable)
     void TakeDamage(int amount) {
-        health -= amount;
+        health -= (int)(amount * damageScale + 0.5f);
         if (health <= 0) {
             health = 0;
             active = false;
@@ -82,70 +146,467 @@ struct Entity {
     }
 };
 
-// Projectile struct for bullets
-struct Projectile : public Entity {
-    float speedX;
-    float speedY;
-    bool isEnemyProjectile;
-    int damage;
+const int MAX_STATUS_EFFECTS = 32768;
+const int STATUS_WHEEL_SLOTS = 64;
+const float STATUS_WHEEL_STEP = 0.1f; // Wheel covers 6.4 s; longer effects go round again
+
+// Active status effects stored as parallel arrays (copied from main.cpp), one entry per (entity,
+// type). Effects are packed into [0, count) so a tick is a linear pass over
+// the arrays, and expiry is handled by a timer wheel instead of checking
+// every effect's remaining time each tick.
+//
+// Effects are referred to by stable ids: an id maps to its current slot and
+// is what the wheel and the owning entity store. An id is only reused after
+// its wheel entry has fired, so the wheel's lists never see a recycled id.
+struct StatusEffects {
+    std::vector<Entity*> owner;
+    std::vector<unsigned char> type;
+    std::vector<float> magnitude;
+    std::vector<float> expireTime;
+    std::vector<float> damageCarry;   // Fractional damage-over-time not yet dealt
+    std::vector<int> idOfSlot;
+    int count;
     
-    // Constructor
-    Projectile() : Entity(0, 0, 5, 1, YELLOW) {
-        speedX = 0;
-        speedY = 0;
-        isEnemyProjectile = false;
-        damage = 10;
-        active = false;
+    std::vector<int> slotOfId;        // -1 once the effect is gone
+    std::vector<int> nextInBucket;
+    std::vector<int> freeIds;         // Recycled ids; ids from nextId up have never been used
+    int nextId;
+    int bucketHead[STATUS_WHEEL_SLOTS];
+    long long wheelStep;              // Last wheel step processed
+    float clock;
+    
+    // Constructor (everything is allocated up front)
+    StatusEffects() {
+        owner.resize(MAX_STATUS_EFFECTS);
+        type.resize(MAX_STATUS_EFFECTS);
+        magnitude.resize(MAX_STATUS_EFFECTS);
+        expireTime.resize(MAX_STATUS_EFFECTS);
+        damageCarry.resize(MAX_STATUS_EFFECTS);
+        idOfSlot.resize(MAX_STATUS_EFFECTS);
+        
+        // Ids of removed effects stay reserved until their timer fires, so there are more ids than slots
+        slotOfId.resize(MAX_STATUS_EFFECTS * 2);
+        nextInBucket.resize(MAX_STATUS_EFFECTS * 2);
+        freeIds.reserve(MAX_STATUS_EFFECTS * 2);
+        count = 0;
+        nextId = 0;
+        Clear();
     }
     
-    // Function to fire a projectile
-    void Fire(float startX, float startY, Direction dir, bool fromEnemy) {
-        x = startX;
-        y = startY;
-        active = true;
-        isEnemyProjectile = fromEnemy;
+    // Remove every effect and restore the affected entities
+    void Clear() {
+        for (int i = 0; i < count; i++) {
+            owner[i]->ClearStatus();
+        }
+        count = 0;
+        freeIds.clear();
+        nextId = 0;
+        for (int b = 0; b < STATUS_WHEEL_SLOTS; b++) {
+            bucketHead[b] = -1;
+        }
+        wheelStep = 0;
+        clock = 0;
+    }
+    
+    // Apply an effect to an entity, or refresh it if the entity already has
+    // one of that type (keeping the longer duration and stronger magnitude).
+    // Returns false when the effect could not be stored.
+    bool Apply(Entity* target, StatusType statusType, float amount, float duration) {
+        int existing = target->statusIds[statusType];
+        if (existing >= 0) {
+            int slot = slotOfId[existing];
+            expireTime[slot] = std::max(expireTime[slot], clock + duration);
+            magnitude[slot] = std::max(magnitude[slot], amount);
+            return true;
+        }
+        if (count >= MAX_STATUS_EFFECTS || (freeIds.empty() && nextId >= (int)slotOfId.size())) {
+            return false;
+        }
         
-        // Set properties based on who fired it
-        if (fromEnemy) {
-            color = RED;
-            damage = 5;
+        int id;
+        if (freeIds.empty()) {
+            id = nextId++;
         } else {
-            color = YELLOW;
-            damage = 10;
+            id = freeIds.back();
+            freeIds.pop_back();
+        }
+        owner[count] = target;
+        type[count] = (unsigned char)statusType;
+        magnitude[count] = amount;
+        expireTime[count] = clock + duration;
+        damageCarry[count] = 0;
+        idOfSlot[count] = id;
+        slotOfId[id] = count;
+        target->statusIds[statusType] = id;
+        count++;
+        Schedule(id, clock + duration);
+        return true;
+    }
+    
+    // Advance time: expire due effects, then recompute every affected entity's
+    // modifiers and deal damage over time. Effects on dead entities are
+    // dropped, including every effect of an entity the burn kills this update.
+    void Update(float deltaTime) {
+        clock += deltaTime;
+        AdvanceWheel();
+        
+        // Reset the modifiers of every affected entity before applying them again
+        for (int i = 0; i < count; i++) {
+            owner[i]->ResetStatusModifiers();
         }
         
-        // Set velocity based on direction
-        speedX = 0;
-        speedY = 0;
+        bool burnedToDeath = false;
+        for (int i = 0; i < count; ) {
+            Entity* target = owner[i];
+            if (!target->active) {
+                RemoveSlot(i);
+                continue;
+            }
+            
+            switch (type[i]) {
+                case STATUS_BURN: {
+                    damageCarry[i] += magnitude[i] * deltaTime;
+                    int damage = (int)damageCarry[i];
+                    damageCarry[i] -= damage;
+                    if (damage > 0) {
+                        target->TakeDamage(damage);
+                        burnedToDeath = burnedToDeath || !target->active;
+                    }
+                    break;
+                }
+                case STATUS_SLOW:
+                    target->speedScale *= 1.0f - magnitude[i];
+                    break;
+                case STATUS_STUN:
+                    target->stunned = true;
+                    target->speedScale = 0;
+                    break;
+                case STATUS_VULNERABLE:
+                    target->damageScale = std::max(target->damageScale, 1.0f + magnitude[i]);
+                    break;
+            }
+            i++;
+        }
         
-        switch (dir) {
-            case UP:
-                speedY = -PROJECTILE_SPEED;
-                break;
-            case RIGHT:
-                speedX = PROJECTILE_SPEED;
-                break;
-            case DOWN:
-                speedY = PROJECTILE_SPEED;
-                break;
-            case LEFT:
-                speedX = -PROJECTILE_SPEED;
-                break;
+        // The victim's other effects may sit in slots that were already
+        // passed, so sweep once more. Otherwise an enemy respawned into the
+        // same slot later this tick would inherit them.
+        if (burnedToDeath) {
+            for (int i = 0; i < count; ) {
+                if (owner[i]->active) {
+                    i++;
+                } else {
+                    RemoveSlot(i);
+                }
+            }
         }
     }
     
-    // Update position of projectile
-    void Update(float deltaTime) {
-        if (active) {
-            x += speedX * deltaTime;
-            y += speedY * deltaTime;
+    // Put an effect's id into the wheel bucket for the given time (or the
+    // farthest bucket, to be rescheduled when it fires)
+    void Schedule(int id, float time) {
+        long long step = (long long)ceil(time / STATUS_WHEEL_STEP);
+        step = std::max(wheelStep + 1, std::min(step, wheelStep + STATUS_WHEEL_SLOTS));
+        int bucket = (int)(step % STATUS_WHEEL_SLOTS);
+        nextInBucket[id] = bucketHead[bucket];
+        bucketHead[bucket] = id;
+    }
+    
+    // Fire every wheel bucket up to the current time
+    void AdvanceWheel() {
+        long long targetStep = (long long)(clock / STATUS_WHEEL_STEP);
+        while (wheelStep < targetStep) {
+            wheelStep++;
+            int bucket = (int)(wheelStep % STATUS_WHEEL_SLOTS);
+            int id = bucketHead[bucket];
+            bucketHead[bucket] = -1;
+            
+            while (id >= 0) {
+                int next = nextInBucket[id];
+                int slot = slotOfId[id];
+                if (slot < 0) {
+                    // Removed early; the id can be reused now
+                    freeIds.push_back(id);
+                } else if (expireTime[slot] > clock) {
+                    // Refreshed or longer than the wheel
+                    Schedule(id, expireTime[slot]);
+                } else {
+                    RemoveSlot(slot);
+                    freeIds.push_back(id);
+                }
+                id = next;
+            }
         }
     }
     
-    // Override Draw to handle const correctness
-    void Draw() const {
-        if (active) {
-            DrawCircle(x, y, radius, color);
+    // Remove the effect in a slot by moving the last effect into it. The id
+    // stays reserved until its wheel entry fires. The owner's modifiers are
+    // reset; any other effects it still has apply them again next update.
+    void RemoveSlot(int slot) {
+        Entity* target = owner[slot];
+        target->statusIds[type[slot]] = -1;
+        target->ResetStatusModifiers();
+        slotOfId[idOfSlot[slot]] = -1;
+        
+        count--;
+        if (slot != count) {
+            owner[slot] = owner[count];
+            type[slot] = type[count];
+            magnitude[slot] = magnitude[count];
+            expireTime[slot] = expireTime[count];
+            damageCarry[slot] = damageCarry[count];
+            idOfSlot[slot] = idOfSlot[count];
+            slotOfId[idOfSlot[slot]] = slot;
+        }
+    }
+};
+
+// Weapon identifiers (copied from main.cpp)
+enum WeaponId {
+    WEAPON_PISTOL,
+    WEAPON_SHOTGUN,
+    WEAPON_RIFLE,
+    WEAPON_MISSILE,
+    WEAPON_LASER,
+    WEAPON_ENEMY_BLASTER,
+    WEAPON_BOSS_SPREAD,
+    WEAPON_BOSS_ORB,
+    WEAPON_COUNT
+};
+
+// The player cycles through the first weapons in the table
+const int PLAYER_WEAPON_COUNT = 5;
+const int MAX_WEAPON_PROJECTILES = 16;
+const int MAX_PROJECTILE_HITS = 8;
+
+// Data describing how a weapon fires
+struct WeaponDef {
+    char name[16];
+    float cooldown;       // Seconds between shots
+    int projectileCount;  // Projectiles per shot, fanned evenly across the spread
+    float spread;         // Total fan angle in degrees
+    float speed;
+    int damage;
+    int pierce;           // Extra enemies a projectile passes through
+    int bounces;          // Times a projectile ricochets off the room walls
+    float homing;         // Turn rate toward the nearest target in radians per second
+    float range;          // Hitscan ray length; 0 fires projectiles instead
+    float blastRadius;    // Explosion radius when a projectile hits or reaches a wall
+    int status;           // StatusType applied on hit
+    float statusDuration;
+    float radius;
+    Color color;
+};
+
+// Default weapon table (copied from main.cpp)
+WeaponDef weaponDefs[WEAPON_COUNT] = {
+    { "PISTOL", PLAYER_SHOOT_COOLDOWN, 1, 0, PROJECTILE_SPEED, 10, 0, 0, 0, 0, 0, STATUS_NONE, 0, 5, YELLOW },
+    { "SHOTGUN", 0.8f, 5, 40.0f, 350.0f, 6, 0, 1, 0, 0, 0, STATUS_SLOW, 1.5f, 4, ORANGE },
+    { "RIFLE", 0.12f, 1, 0, 600.0f, 5, 2, 0, 0, 0, 0, STATUS_VULNERABLE, 2.0f, 3, SKYBLUE },
+    { "MISSILE", 0.6f, 1, 0, 300.0f, 15, 0, 0, 4.0f, 0, 60.0f, STATUS_BURN, 3.0f, 4, LIME },
+    { "LASER", 0.05f, 1, 0, 0, 2, 1, 0, 0, 500.0f, 0, STATUS_NONE, 0, 2, GREEN },
+    { "BLASTER", ENEMY_SHOOT_COOLDOWN, 1, 0, PROJECTILE_SPEED, 5, 0, 0, 0, 0, 0, STATUS_NONE, 0, 5, RED },
+    { "BOSS_SPREAD", 1.2f, 3, 30.0f, 300.0f, 5, 0, 0, 0.6f, 0, 0, STATUS_SLOW, 1.0f, 6, MAGENTA },
+    { "BOSS_ORB", 1.0f, 1, 0, 180.0f, 4, 0, 0, 0, 0, 0, STATUS_NONE, 0, 5, PINK }
+};
+
+// copied from main.cpp
+// Fingerprint of the weapon table (FNV-1a over every field). Replays store
+// it, since they only re-simulate correctly with the weapons they were
+// recorded with.
+unsigned int HashWeaponDefs() {
+    unsigned int hash = 2166136261u;
+    auto mix = [&hash](const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+    };
+    for (const WeaponDef& def : weaponDefs) {
+        mix(def.name, strlen(def.name) + 1);
+        mix(&def.cooldown, sizeof(def.cooldown));
+        mix(&def.projectileCount, sizeof(def.projectileCount));
+        mix(&def.spread, sizeof(def.spread));
+        mix(&def.speed, sizeof(def.speed));
+        mix(&def.damage, sizeof(def.damage));
+        mix(&def.pierce, sizeof(def.pierce));
+        mix(&def.bounces, sizeof(def.bounces));
+        mix(&def.homing, sizeof(def.homing));
+        mix(&def.range, sizeof(def.range));
+        mix(&def.blastRadius, sizeof(def.blastRadius));
+        mix(&def.status, sizeof(def.status));
+        mix(&def.statusDuration, sizeof(def.statusDuration));
+        mix(&def.radius, sizeof(def.radius));
+        mix(&def.color, sizeof(def.color));
+    }
+    return hash;
+}
+
+// Unit vectors for each Direction (UP, RIGHT, DOWN, LEFT)
+const float DIRECTION_X[4] = { 0, 1, 0, -1 };
+const float DIRECTION_Y[4] = { -1, 0, 1, 0 };
+
+const int MAX_PROJECTILES = 1024;
+
+// Projectiles stored as parallel arrays with a fixed hit buffer for piercing
+// projectiles (copied from main.cpp)
+struct ProjectilePool {
+    float x[MAX_PROJECTILES];
+    float y[MAX_PROJECTILES];
+    float speedX[MAX_PROJECTILES];
+    float speedY[MAX_PROJECTILES];
+    float radius[MAX_PROJECTILES];
+    int damage[MAX_PROJECTILES];
+    int pierce[MAX_PROJECTILES];
+    int bounces[MAX_PROJECTILES];
+    float homing[MAX_PROJECTILES];
+    float blastRadius[MAX_PROJECTILES];
+    unsigned char weapon[MAX_PROJECTILES];
+    bool fromEnemy[MAX_PROJECTILES];
+    Color color[MAX_PROJECTILES];
+    unsigned char hitCount[MAX_PROJECTILES];
+    short hits[MAX_PROJECTILES][MAX_PROJECTILE_HITS];
+    unsigned short hitGeneration[MAX_PROJECTILES][MAX_PROJECTILE_HITS];
+    int count;
+    
+    // Constructor
+    ProjectilePool() {
+        count = 0;
+    }
+    
+    // Remove all projectiles
+    void Clear() {
+        count = 0;
+    }
+    
+    // Add a projectile fired with the given weapon id; returns false when full
+    bool Spawn(float startX, float startY, float velocityX, float velocityY, int weaponId, bool enemy) {
+        if (count >= MAX_PROJECTILES) {
+            return false;
+        }
+        const WeaponDef& def = weaponDefs[weaponId];
+        x[count] = startX;
+        y[count] = startY;
+        speedX[count] = velocityX;
+        speedY[count] = velocityY;
+        radius[count] = def.radius;
+        damage[count] = def.damage;
+        pierce[count] = def.pierce;
+        bounces[count] = def.bounces;
+        homing[count] = def.homing;
+        blastRadius[count] = def.blastRadius;
+        weapon[count] = (unsigned char)weaponId;
+        fromEnemy[count] = enemy;
+        color[count] = def.color;
+        hitCount[count] = 0;
+        count++;
+        return true;
+    }
+    
+    // Add a batch of projectiles of one weapon from precomputed offsets and
+    // velocities (no trigonometry per shot); returns how many fit in the pool
+    int SpawnBatch(float originX, float originY, const float* offsetX, const float* offsetY,
+                   const float* velocityX, const float* velocityY, int batchSize, int weaponId, bool enemy) {
+        batchSize = std::min(batchSize, MAX_PROJECTILES - count);
+        const WeaponDef& def = weaponDefs[weaponId];
+        for (int k = 0; k < batchSize; k++) {
+            int i = count + k;
+            x[i] = originX + offsetX[k];
+            y[i] = originY + offsetY[k];
+            speedX[i] = velocityX[k];
+            speedY[i] = velocityY[k];
+            radius[i] = def.radius;
+            damage[i] = def.damage;
+            pierce[i] = def.pierce;
+            bounces[i] = def.bounces;
+            homing[i] = def.homing;
+            blastRadius[i] = def.blastRadius;
+            weapon[i] = (unsigned char)weaponId;
+            fromEnemy[i] = enemy;
+            color[i] = def.color;
+            hitCount[i] = 0;
+        }
+        count += batchSize;
+        return batchSize;
+    }
+    
+    // Remove a projectile by moving the last live one into its slot
+    void Remove(int i) {
+        count--;
+        x[i] = x[count];
+        y[i] = y[count];
+        speedX[i] = speedX[count];
+        speedY[i] = speedY[count];
+        radius[i] = radius[count];
+        damage[i] = damage[count];
+        pierce[i] = pierce[count];
+        bounces[i] = bounces[count];
+        homing[i] = homing[count];
+        blastRadius[i] = blastRadius[count];
+        weapon[i] = weapon[count];
+        fromEnemy[i] = fromEnemy[count];
+        color[i] = color[count];
+        hitCount[i] = hitCount[count];
+        memcpy(hits[i], hits[count], sizeof(hits[i]));
+        memcpy(hitGeneration[i], hitGeneration[count], sizeof(hitGeneration[i]));
+    }
+    
+    // Check if a projectile already hit the enemy at this index in this spawn generation
+    bool HasHit(int i, int enemyIndex, unsigned short generation) const {
+        for (int h = 0; h < hitCount[i]; h++) {
+            if (hits[i][h] == enemyIndex && hitGeneration[i][h] == generation) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Register a hit; returns true if the projectile pierces through and
+    // stays alive, false if it is used up
+    bool RecordHit(int i, int enemyIndex, unsigned short generation) {
+        if (pierce[i] <= 0 || hitCount[i] >= MAX_PROJECTILE_HITS) {
+            return false;
+        }
+        pierce[i]--;
+        hits[i][hitCount[i]] = (short)enemyIndex;
+        hitGeneration[i][hitCount[i]] = generation;
+        hitCount[i]++;
+        return true;
+    }
+    
+    // Turn a projectile toward a target by at most maxTurn radians, keeping its speed
+    void SteerToward(int i, float targetX, float targetY, float maxTurn) {
+        float toX = targetX - x[i];
+        float toY = targetY - y[i];
+        float turn = atan2(speedX[i] * toY - speedY[i] * toX, speedX[i] * toX + speedY[i] * toY);
+        turn = std::max(-maxTurn, std::min(turn, maxTurn));
+        float c = cos(turn);
+        float s = sin(turn);
+        float newSpeedX = speedX[i] * c - speedY[i] * s;
+        speedY[i] = speedX[i] * s + speedY[i] * c;
+        speedX[i] = newSpeedX;
+    }
+    
+    // Move every live projectile and reflect the ones that still have bounces
+    // off the given walls. The loop uses selects instead of branches so the
+    // compiler can vectorize it; projectiles without bounces are left outside
+    // for the caller to remove.
+    void Integrate(float deltaTime, float minX, float minY, float maxX, float maxY) {
+        for (int i = 0; i < count; i++) {
+            float nextX = x[i] + speedX[i] * deltaTime;
+            float nextY = y[i] + speedY[i] * deltaTime;
+            float wallX = std::min(std::max(nextX, minX), maxX);
+            float wallY = std::min(std::max(nextY, minY), maxY);
+            bool canBounce = bounces[i] > 0;
+            bool bounceX = canBounce & (wallX != nextX);
+            bool bounceY = canBounce & (wallY != nextY);
+            
+            // Mirror the overshoot back inside the room and flip the velocity
+            x[i] = bounceX ? 2 * wallX - nextX : nextX;
+            y[i] = bounceY ? 2 * wallY - nextY : nextY;
+            speedX[i] = bounceX ? -speedX[i] : speedX[i];
+            speedY[i] = bounceY ? -speedY[i] : speedY[i];
+            bounces[i] -= (bounceX | bounceY);
         }
     }
 };
@@ -200,15 +661,44 @@ struct Enemy : public Entity {
     bool aggro;
     std::mt19937* rng;
     float moveTimer;
+    float lodTime;
+    int weapon;
+    bool lootDropped;
+    int squad;            // Squad id in the room, -1 when roaming alone
+    bool canSee;          // Line of sight to the player, decided by the game each tick
+    unsigned short generation;  // Bumped on every respawn, so hits on the slot's previous enemy don't count
     
     // Constructor
     Enemy(float startX, float startY, std::mt19937* randomGen) : Entity(startX, startY, 12, ENEMY_HEALTH, RED) {
         speedX = 0;
         speedY = 0;
         shootCooldown = 0;
+        weapon = WEAPON_ENEMY_BLASTER;
+        lootDropped = false;
+        squad = -1;
+        canSee = true;
         aggro = false;
         rng = randomGen;
         moveTimer = 0;
+        lodTime = 0;
+        generation = 0;
+        ChangeDirection();
+    }
+    
+    // Change movement direction randomly
+    void ChangeDirection() {
+        std::uniform_real_distribution<float> angleDist(0, 6.28318f); // 2*PI
+        float angle = angleDist(*rng);
+        
+        speedX = cos(angle) * ENEMY_SPEED;
+        speedY = sin(angle) * ENEMY_SPEED;
+        
+        // Set facing direction based on velocity
+        if (fabs(speedX) > fabs(speedY)) {
+            facing = speedX > 0 ? RIGHT : LEFT;
+        } else {
+            facing = speedY > 0 ? DOWN : UP;
+        }
     }
     
     // Update enemy movement and state
@@ -235,6 +725,28 @@ struct Enemy : public Entity {
     void ResetShootCooldown() {
         shootCooldown = ENEMY_SHOOT_COOLDOWN;
     }
+    
+    // Bring a dead or pooled enemy back to life at a new position
+    virtual void Respawn(float startX, float startY) {
+        x = startX;
+        y = startY;
+        health = maxHealth;
+        active = true;
+        shootCooldown = 0;
+        aggro = false;
+        moveTimer = 0;
+        lodTime = 0;
+        lootDropped = false;
+        squad = -1;
+        canSee = true;
+        generation++;
+        ChangeDirection();
+    }
+    
+    // Bosses are never recycled through the enemy pool
+    virtual bool IsBoss() const {
+        return false;
+    }
 };
 
 // Boss struct inherits from Enemy
@@ -246,290 +758,5483 @@ struct Boss : public Enemy {
         maxHealth = BOSS_HEALTH;
         color = PURPLE;
     }
+    
+    // Identify boss for the enemy pool
+    bool IsBoss() const override {
+        return true;
+    }
 };
 
-// Room struct for level design
-struct Room {
-    float x;
-    float y;
-    float width;
-    float height;
-    std::vector<std::unique_ptr<Enemy>> enemies;
-    bool cleared;
-    bool hasBoss;
+// Preallocated enemies handed out to rooms and returned when a room is left
+// or the game is reset, so spawning and restarting never allocate
+struct EnemyPool {
+    std::vector<std::unique_ptr<Enemy>> available;
+    std::vector<std::unique_ptr<Enemy>> bosses;
+    int allocated;
     
     // Constructor
-    Room(float posX, float posY, float w, float h, bool boss = false) {
-        x = posX;
-        y = posY;
-        width = w;
-        height = h;
-        cleared = false;
-        hasBoss = boss;
+    EnemyPool() {
+        allocated = 0;
     }
     
-    // Add enemy to room
-    void AddEnemy(float enemyX, float enemyY, std::mt19937* rng) {
-        enemies.push_back(std::make_unique<Enemy>(enemyX, enemyY, rng));
+    // Make sure at least count regular enemies exist (in the pool or in rooms)
+    void Preallocate(int count, std::mt19937* rng) {
+        available.reserve(count);
+        while (allocated < count) {
+            auto enemy = std::make_unique<Enemy>(0, 0, rng);
+            enemy->active = false;
+            available.push_back(std::move(enemy));
+            allocated++;
+        }
     }
     
-    // Add boss to room
-    void AddBoss(float bossX, float bossY, std::mt19937* rng) {
-        enemies.push_back(std::make_unique<Boss>(bossX, bossY, rng));
+    // Take an enemy out of the pool (nullptr if the pool is empty)
+    std::unique_ptr<Enemy> Acquire(float startX, float startY) {
+        if (available.empty()) {
+            return nullptr;
+        }
+        std::unique_ptr<Enemy> enemy = std::move(available.back());
+        available.pop_back();
+        enemy->Respawn(startX, startY);
+        return enemy;
     }
     
-    // Update room and contained enemies
-    void Update(float deltaTime, Player* player) {
-        // Update all active enemies
-        for (auto& enemy : enemies) {
-            if (enemy && enemy->active) {
-                enemy->Update(deltaTime, player);
-            }
+    // Take a boss out of the pool (only allocates the first time)
+    std::unique_ptr<Enemy> AcquireBoss(float startX, float startY, std::mt19937* rng) {
+        if (bosses.empty()) {
+            return std::make_unique<Boss>(startX, startY, rng);
         }
-        
-        // Check if room is cleared
-        cleared = true;
-        for (const auto& enemy : enemies) {
-            if (enemy && enemy->active) {
-                cleared = false;
-                break;
-            }
+        std::unique_ptr<Enemy> boss = std::move(bosses.back());
+        bosses.pop_back();
+        boss->Respawn(startX, startY);
+        return boss;
+    }
+    
+    // Give an enemy back to the pool
+    void Release(std::unique_ptr<Enemy> enemy) {
+        enemy->active = false;
+        if (enemy->IsBoss()) {
+            bosses.push_back(std::move(enemy));
+        } else {
+            available.push_back(std::move(enemy));
         }
     }
+};
+
+// copied from main.cpp
+// Shapes a squad can hold while it moves
+enum FormationType {
+    FORMATION_LINE,
+    FORMATION_WEDGE,
+    FORMATION_BOX,
+    FORMATION_COUNT
+};
+
+const int MAX_SQUADS = 16;
+const int MAX_SQUAD_SIZE = 12;
+const float SQUAD_SPACING = 34.0f;
+const float SQUAD_SPEED = 60.0f;
+const float SQUAD_THINK_STEP = 0.5f;      // Seconds between squad heading decisions
+const float SQUAD_HOLD_DISTANCE = 180.0f; // Squads stop advancing this close to the player
+const float SQUAD_CATCH_UP_SPEED = 120.0f;
+
+// Slot offsets from the squad leader for every formation, filled in once at
+// startup. Slots are ordered so that any number of members stays centred.
+struct FormationTable {
+    float slotX[FORMATION_COUNT][MAX_SQUAD_SIZE];
+    float slotY[FORMATION_COUNT][MAX_SQUAD_SIZE];
     
-    // Check if a point is inside the room
-    bool ContainsPoint(float pointX, float pointY) {
-        return (pointX >= x && pointX <= x + width && pointY >= y && pointY <= y + height);
+    // Constructor
+    FormationTable() {
+        for (int i = 0; i < MAX_SQUAD_SIZE; i++) {
+            // Line: 0, +1, -1, +2, -2, ... across
+            int side = (i % 2 == 1) ? 1 : -1;
+            slotX[FORMATION_LINE][i] = side * ((i + 1) / 2) * SQUAD_SPACING;
+            slotY[FORMATION_LINE][i] = 0;
+            
+            // Wedge: the leader's slot at the tip, then pairs folding back
+            slotX[FORMATION_WEDGE][i] = side * ((i + 1) / 2) * SQUAD_SPACING;
+            slotY[FORMATION_WEDGE][i] = ((i + 1) / 2) * SQUAD_SPACING;
+            
+            // Box: rows of four
+            slotX[FORMATION_BOX][i] = (i % 4 - 1.5f) * SQUAD_SPACING;
+            slotY[FORMATION_BOX][i] = (i / 4) * SQUAD_SPACING;
+        }
     }
 };
 
-// Simple test framework
-void RunTests();
-void TestEntityCreation();
-void TestEntityCollision();
-void TestProjectile();
-void TestPlayer();
-void TestEnemy();
-void TestRoom();
+const FormationTable FORMATIONS;
 
-int main() {
-    // Initialize window (needed for Raylib)
-    InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Test Window");
-    SetWindowState(FLAG_WINDOW_HIDDEN); // Hide the window for tests
+// Enemy squads of one room. Decisions are made once per squad for a virtual
+// leader, and members follow fixed slot offsets from it, so a large
+// coordinated wave costs one decision per squad plus one offset add per
+// member. Members are packed in [0, memberCount) and removed by swapping.
+struct Squads {
+    int squadCount;
+    int memberCount;
     
-    // Run tests
-    std::cout << "Running unit tests for Top-Down Shooter game..." << std::endl;
+    // Per squad
+    float leaderX[MAX_SQUADS];
+    float leaderY[MAX_SQUADS];
+    float leaderSpeedX[MAX_SQUADS];
+    float leaderSpeedY[MAX_SQUADS];
+    float thinkTimer[MAX_SQUADS];
+    int formation[MAX_SQUADS];
+    int size[MAX_SQUADS];         // Slots handed out so far
     
-    RunTests();
+    // Per member
+    Enemy* memberEnemy[MAX_ROOM_ENEMIES];
+    int memberSquad[MAX_ROOM_ENEMIES];
+    float memberSlotX[MAX_ROOM_ENEMIES];
+    float memberSlotY[MAX_ROOM_ENEMIES];
+    float targetX[MAX_ROOM_ENEMIES];
+    float targetY[MAX_ROOM_ENEMIES];
     
-    std::cout << "All tests passed!" << std::endl;
-    std::cout << "Press any key to exit..." << std::endl;
-    _getch(); // Wait for user to press a key before exiting
+    // Constructor
+    Squads() {
+        squadCount = 0;
+        memberCount = 0;
+    }
     
-    // Close window
-    CloseWindow();
+    // Remove all squads
+    void Clear() {
+        squadCount = 0;
+        memberCount = 0;
+    }
     
-    return 0;
-}
-
-void RunTests() {
-    TestEntityCreation();
-    TestEntityCollision();
-    TestProjectile();
-    TestPlayer();
-    TestEnemy();
-    TestRoom();
-}
-
-void TestEntityCreation() {
-    std::cout << "Testing Entity creation..." << std::endl;
+    // Start a squad with its leader at a position; returns its id, or -1 when
+    // the room has no squads left (ids are not reused until Clear)
+    int Create(float startX, float startY, int formationType) {
+        if (squadCount >= MAX_SQUADS) {
+            return -1;
+        }
+        int s = squadCount++;
+        leaderX[s] = startX;
+        leaderY[s] = startY;
+        leaderSpeedX[s] = 0;
+        leaderSpeedY[s] = 0;
+        thinkTimer[s] = 0;
+        formation[s] = formationType;
+        size[s] = 0;
+        return s;
+    }
     
-    // Create an entity
-    Entity entity(100, 200, 15, 50, RED);
+    // Check if a squad can take another member
+    bool HasSlot(int s) const {
+        return size[s] < MAX_SQUAD_SIZE && memberCount < MAX_ROOM_ENEMIES;
+    }
     
-    // Verify its properties
-    assert(entity.x == 100);
-    assert(entity.y == 200);
-    assert(entity.radius == 15);
-    assert(entity.health == 50);
-    assert(entity.maxHealth == 50);
-    assert(entity.active == true);
-    assert(entity.color.r == RED.r && entity.color.g == RED.g && entity.color.b == RED.b);
-    assert(entity.facing == RIGHT);
+    // Position of the next free slot in a squad
+    float NextSlotX(int s) const {
+        return leaderX[s] + FORMATIONS.slotX[formation[s]][size[s]];
+    }
+    float NextSlotY(int s) const {
+        return leaderY[s] + FORMATIONS.slotY[formation[s]][size[s]];
+    }
     
-    // Test taking damage
-    entity.TakeDamage(20);
-    assert(entity.health == 30);
+    // Give an enemy the next free slot of a squad (check HasSlot first)
+    void AddMember(int s, Enemy* enemy) {
+        int m = memberCount++;
+        memberEnemy[m] = enemy;
+        memberSquad[m] = s;
+        memberSlotX[m] = FORMATIONS.slotX[formation[s]][size[s]];
+        memberSlotY[m] = FORMATIONS.slotY[formation[s]][size[s]];
+        targetX[m] = leaderX[s] + memberSlotX[m];
+        targetY[m] = leaderY[s] + memberSlotY[m];
+        size[s]++;
+    }
     
-    // Test entity deactivation when health reaches 0
-    entity.TakeDamage(30);
-    assert(entity.health == 0);
-    assert(entity.active == false);
+    // Remove a member by moving the last one into its place
+    void RemoveMember(int m) {
+        memberCount--;
+        memberEnemy[m] = memberEnemy[memberCount];
+        memberSquad[m] = memberSquad[memberCount];
+        memberSlotX[m] = memberSlotX[memberCount];
+        memberSlotY[m] = memberSlotY[memberCount];
+        targetX[m] = targetX[memberCount];
+        targetY[m] = targetY[memberCount];
+    }
     
-    std::cout << "Entity creation test passed!" << std::endl;
-}
+    // Steer every leader toward the player (holding at SQUAD_HOLD_DISTANCE),
+    // keep leaders inside the given bounds, then place every member's target
+    // at its leader plus its slot offset
+    void Update(float deltaTime, float playerX, float playerY, float minX, float minY, float maxX, float maxY) {
+        for (int s = 0; s < squadCount; s++) {
+            thinkTimer[s] -= deltaTime;
+            if (thinkTimer[s] <= 0) {
+                thinkTimer[s] += SQUAD_THINK_STEP;
+                float dx = playerX - leaderX[s];
+                float dy = playerY - leaderY[s];
+                float distance = sqrt(dx*dx + dy*dy);
+                float speed = distance > SQUAD_HOLD_DISTANCE ? SQUAD_SPEED / distance : 0;
+                leaderSpeedX[s] = dx * speed;
+                leaderSpeedY[s] = dy * speed;
+            }
+            leaderX[s] = std::max(minX, std::min(leaderX[s] + leaderSpeedX[s] * deltaTime, maxX));
+            leaderY[s] = std::max(minY, std::min(leaderY[s] + leaderSpeedY[s] * deltaTime, maxY));
+        }
+        
+        for (int m = 0; m < memberCount; m++) {
+            targetX[m] = leaderX[memberSquad[m]] + memberSlotX[m];
+            targetY[m] = leaderY[memberSquad[m]] + memberSlotY[m];
+        }
+    }
+};
 
-void TestEntityCollision() {
-    std::cout << "Testing Entity collision..." << std::endl;
+const int SQUAD_POOL_SIZE = 2;   // Only the room the player is in spawns waves
+
+// Preallocated squad storage, lent to a room when its first formation wave
+// starts and returned when the room is left or the game is reset, so rooms
+// without formations on the way don't carry their arrays around
+struct SquadPool {
+    std::vector<std::unique_ptr<Squads>> available;
+    int allocated;
     
-    // Create two entities
-    Entity entity1(100, 100, 15, 50, RED);
-    Entity entity2(120, 100, 15, 50, BLUE);
+    // Constructor
+    SquadPool() {
+        allocated = 0;
+    }
     
-    // Test collision detection
-    assert(entity1.IsColliding(&entity2) == true);
+    // Make sure at least count squad sets exist (in the pool or in rooms)
+    void Preallocate(int count) {
+        available.reserve(count);
+        while (allocated < count) {
+            available.push_back(std::make_unique<Squads>());
+            allocated++;
+        }
+    }
     
-    // Move entity2 far enough away to avoid collision
-    entity2.x = 200;
-    assert(entity1.IsColliding(&entity2) == false);
+    // Take an empty squad set out of the pool (nullptr if the pool is empty)
+    std::unique_ptr<Squads> Acquire() {
+        if (available.empty()) {
+            return nullptr;
+        }
+        std::unique_ptr<Squads> squads = std::move(available.back());
+        available.pop_back();
+        squads->Clear();
+        return squads;
+    }
     
-    std::cout << "Entity collision test passed!" << std::endl;
-}
+    // Give a squad set back to the pool
+    void Release(std::unique_ptr<Squads> squads) {
+        if (squads) {
+            available.push_back(std::move(squads));
+        }
+    }
+};
+
+// A timed group of enemies spawned one after another inside a room,
+// optionally grouped into squads holding a formation
+struct Wave {
+    float startTime;
+    int count;
+    float interval;
+    int formation;        // FormationType, or -1 for enemies that roam alone
+};
+
+// copied from main.cpp
+// Tile types of a room's collision grid
+enum TileType {
+    TILE_FLOOR,
+    TILE_WALL
+};
+
+const float TILE_SIZE = 40.0f;
+const int TILE_WALL_HEALTH = 30;
+
+// A rectangle of grid cells (inclusive) that changed since a cache was last
+// brought up to date
+struct DirtyRect {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+    
+    // Constructor
+    DirtyRect() {
+        Clear();
+    }
+    
+    // Forget every change (once the cache has caught up)
+    void Clear() {
+        x0 = 0;
+        y0 = 0;
+        x1 = -1;
+        y1 = -1;
+    }
+    
+    // Check if nothing changed
+    bool IsEmpty() const {
+        return x0 > x1;
+    }
+    
+    // Check if another rectangle shares a cell with this one
+    bool Overlaps(int left, int top, int right, int bottom) const {
+        return !IsEmpty() && left <= x1 && right >= x0 && top <= y1 && bottom >= y0;
+    }
+    
+    // Grow to cover another rectangle
+    void Add(int left, int top, int right, int bottom) {
+        if (IsEmpty()) {
+            x0 = left;
+            y0 = top;
+            x1 = right;
+            y1 = bottom;
+        } else {
+            x0 = std::min(x0, left);
+            y0 = std::min(y0, top);
+            x1 = std::max(x1, right);
+            y1 = std::max(y1, bottom);
+        }
+    }
+};
+
+// A room's collision geometry as a grid of square tiles. Everything outside
+// the grid counts as solid. Wall tiles can be destroyed; the tiles that
+// changed are collected in a dirty rectangle so the caches built from the
+// grid (the tile texture and the light map) only redo that area.
+struct TileGrid {
+    float originX;
+    float originY;
+    int tilesX;
+    int tilesY;
+    std::vector<unsigned char> tiles;
+    std::vector<unsigned char> health;   // Hits left on wall tiles
+    DirtyRect dirty;
+    
+    // Constructor
+    TileGrid() {
+        originX = 0;
+        originY = 0;
+        tilesX = 0;
+        tilesY = 0;
+    }
+    
+    // Cover an area with floor tiles (keeps the storage when the size repeats)
+    void Reset(float left, float top, float width, float height) {
+        originX = left;
+        originY = top;
+        tilesX = std::max(1, (int)ceil(width / TILE_SIZE));
+        tilesY = std::max(1, (int)ceil(height / TILE_SIZE));
+        tiles.assign(tilesX * tilesY, TILE_FLOOR);
+        health.assign(tilesX * tilesY, 0);
+        dirty.Clear();
+        dirty.Add(0, 0, tilesX - 1, tilesY - 1);
+    }
+    
+    // Copy another grid's tiles to a new origin (keeps the storage when the
+    // size repeats)
+    void Place(const TileGrid& other, float left, float top) {
+        originX = left;
+        originY = top;
+        tilesX = other.tilesX;
+        tilesY = other.tilesY;
+        tiles.assign(other.tiles.begin(), other.tiles.end());
+        health.assign(other.health.begin(), other.health.end());
+        dirty.Clear();
+        dirty.Add(0, 0, tilesX - 1, tilesY - 1);
+    }
+    
+    // Free the storage (for a room that was streamed out)
+    void Release() {
+        std::vector<unsigned char>().swap(tiles);
+        std::vector<unsigned char>().swap(health);
+        tilesX = 0;
+        tilesY = 0;
+        dirty.Clear();
+    }
+    
+    // Tile coordinates of a position (clamped to the grid)
+    int TileX(float px) const {
+        return std::max(0, std::min((int)floor((px - originX) / TILE_SIZE), tilesX - 1));
+    }
+    int TileY(float py) const {
+        return std::max(0, std::min((int)floor((py - originY) / TILE_SIZE), tilesY - 1));
+    }
+    
+    // Index of the tile containing a position
+    int TileIndex(float px, float py) const {
+        return TileY(py) * tilesX + TileX(px);
+    }
+    
+    // Check if a tile blocks movement and sight
+    bool IsSolid(int tx, int ty) const {
+        if (tx < 0 || ty < 0 || tx >= tilesX || ty >= tilesY) {
+            return true;
+        }
+        return tiles[ty * tilesX + tx] != TILE_FLOOR;
+    }
+    
+    // Check if a position lies in a solid tile
+    bool SolidAt(float px, float py) const {
+        return IsSolid((int)floor((px - originX) / TILE_SIZE), (int)floor((py - originY) / TILE_SIZE));
+    }
+    
+    // Set a rectangle of tiles (inclusive, clipped to the grid)
+    void Fill(int x0, int y0, int x1, int y1, TileType type) {
+        for (int ty = std::max(y0, 0); ty <= std::min(y1, tilesY - 1); ty++) {
+            for (int tx = std::max(x0, 0); tx <= std::min(x1, tilesX - 1); tx++) {
+                tiles[ty * tilesX + tx] = (unsigned char)type;
+                health[ty * tilesX + tx] = type == TILE_WALL ? TILE_WALL_HEALTH : 0;
+            }
+        }
+        dirty.Add(std::max(x0, 0), std::max(y0, 0), std::min(x1, tilesX - 1), std::min(y1, tilesY - 1));
+    }
+    
+    // Damage a wall tile. Returns true if it was destroyed (it becomes floor).
+    bool Damage(int tx, int ty, int amount) {
+        if (tx < 0 || ty < 0 || tx >= tilesX || ty >= tilesY || tiles[ty * tilesX + tx] == TILE_FLOOR) {
+            return false;
+        }
+        int i = ty * tilesX + tx;
+        if (health[i] > amount) {
+            health[i] -= amount;
+            return false;
+        }
+        tiles[i] = TILE_FLOOR;
+        health[i] = 0;
+        dirty.Add(tx, ty, tx, ty);
+        return true;
+    }
+    
+    // Push a circle out of the solid tiles it overlaps
+    void PushOut(float& px, float& py, float r) const {
+        for (int ty = TileY(py - r); ty <= TileY(py + r); ty++) {
+            for (int tx = TileX(px - r); tx <= TileX(px + r); tx++) {
+                if (tiles[ty * tilesX + tx] == TILE_FLOOR) {
+                    continue;
+                }
+                float left = originX + tx * TILE_SIZE;
+                float top = originY + ty * TILE_SIZE;
+                float dx = px - std::max(left, std::min(px, left + TILE_SIZE));
+                float dy = py - std::max(top, std::min(py, top + TILE_SIZE));
+                float distSquared = dx*dx + dy*dy;
+                if (distSquared >= r * r) {
+                    continue;
+                }
+                if (distSquared > 0) {
+                    float dist = sqrt(distSquared);
+                    px += dx / dist * (r - dist);
+                    py += dy / dist * (r - dist);
+                } else {
+                    // Centre inside the tile: leave through the nearest side
+                    float toLeft = px - left;
+                    float toRight = left + TILE_SIZE - px;
+                    float toTop = py - top;
+                    float toBottom = top + TILE_SIZE - py;
+                    float nearest = std::min(std::min(toLeft, toRight), std::min(toTop, toBottom));
+                    if (nearest == toLeft) {
+                        px = left - r;
+                    } else if (nearest == toRight) {
+                        px = left + TILE_SIZE + r;
+                    } else if (nearest == toTop) {
+                        py = top - r;
+                    } else {
+                        py = top + TILE_SIZE + r;
+                    }
+                }
+            }
+        }
+    }
+    
+    // Check if the line between the centres of two tiles crosses no solid
+    // tile. This is an integer DDA, so the result only depends on the two
+    // tiles; a line passing exactly through a corner between two solid
+    // tiles is blocked.
+    bool LineClear(int fromX, int fromY, int toX, int toY) const {
+        int stepX = toX > fromX ? 1 : -1;
+        int stepY = toY > fromY ? 1 : -1;
+        int spanX = abs(toX - fromX);
+        int spanY = abs(toY - fromY);
+        int tx = fromX;
+        int ty = fromY;
+        for (int ix = 0, iy = 0; ix < spanX || iy < spanY; ) {
+            // Compare when the line crosses the next vertical and horizontal tile border
+            int decision = (1 + 2 * ix) * spanY - (1 + 2 * iy) * spanX;
+            if (decision == 0) {
+                if (IsSolid(tx + stepX, ty) && IsSolid(tx, ty + stepY)) {
+                    return false;
+                }
+                tx += stepX;
+                ty += stepY;
+                ix++;
+                iy++;
+            } else if (decision < 0) {
+                tx += stepX;
+                ix++;
+            } else {
+                ty += stepY;
+                iy++;
+            }
+            if (IsSolid(tx, ty)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // Distance along a normalized ray to the first solid tile (DDA over the
+    // grid), or maxDistance if there is none before that
+    float RayDistance(float startX, float startY, float dirX, float dirY, float maxDistance) const {
+        int tx = (int)floor((startX - originX) / TILE_SIZE);
+        int ty = (int)floor((startY - originY) / TILE_SIZE);
+        if (IsSolid(tx, ty)) {
+            return 0;
+        }
+        int stepX = dirX > 0 ? 1 : -1;
+        int stepY = dirY > 0 ? 1 : -1;
+        float deltaX = dirX != 0 ? TILE_SIZE / fabs(dirX) : INFINITY;
+        float deltaY = dirY != 0 ? TILE_SIZE / fabs(dirY) : INFINITY;
+        float nextX = dirX != 0 ? ((originX + (tx + (stepX > 0)) * TILE_SIZE) - startX) / dirX : INFINITY;
+        float nextY = dirY != 0 ? ((originY + (ty + (stepY > 0)) * TILE_SIZE) - startY) / dirY : INFINITY;
+        
+        float t = 0;
+        while (t < maxDistance) {
+            if (nextX < nextY) {
+                t = nextX;
+                nextX += deltaX;
+                tx += stepX;
+            } else {
+                t = nextY;
+                nextY += deltaY;
+                ty += stepY;
+            }
+            if (t < maxDistance && IsSolid(tx, ty)) {
+                return t;
+            }
+        }
+        return maxDistance;
+    }
+};
+
+// copied from main.cpp
+const int FOG_SIGHT_TILES = 8;        // How far the player sees, in tiles
+const int FOG_WORD_BITS = 64;
+
+// Fog of war over a room's tiles, one bit per tile. Rows are padded to whole
+// 64-bit words, so combining masks handles 64 tiles per operation. The field
+// of view is recomputed with shadowcasting only when the player moves to
+// another tile, and the tiles that changed are collected in a dirty
+// rectangle for the fog texture.
+struct FogOfWar {
+    int tilesX;
+    int tilesY;
+    int wordsPerRow;
+    std::vector<unsigned long long> visible;   // Seen from the player's current tile
+    std::vector<unsigned long long> explored;  // Seen at some point since entering the room
+    std::vector<unsigned long long> previous;  // Visible before the last update
+    int viewTile;                              // Tile the view was computed from, -1 to force an update
+    DirtyRect dirty;                           // Tiles whose state changed
+    
+    // Constructor
+    FogOfWar() {
+        tilesX = 0;
+        tilesY = 0;
+        wordsPerRow = 0;
+        viewTile = -1;
+    }
+    
+    // Cover a tile grid with unexplored fog
+    void Reset(const TileGrid& grid) {
+        tilesX = grid.tilesX;
+        tilesY = grid.tilesY;
+        wordsPerRow = (tilesX + FOG_WORD_BITS - 1) / FOG_WORD_BITS;
+        visible.assign(wordsPerRow * tilesY, 0);
+        explored.assign(wordsPerRow * tilesY, 0);
+        previous.assign(wordsPerRow * tilesY, 0);
+        viewTile = -1;
+        dirty.Clear();
+        dirty.Add(0, 0, tilesX - 1, tilesY - 1);
+    }
+    
+    // Force the next update to recompute the view (after the walls change)
+    void Invalidate() {
+        viewTile = -1;
+    }
+    
+    // Check a tile's state
+    bool IsVisible(int tx, int ty) const {
+        return (visible[ty * wordsPerRow + tx / FOG_WORD_BITS] >> (tx % FOG_WORD_BITS)) & 1;
+    }
+    bool IsExplored(int tx, int ty) const {
+        return (explored[ty * wordsPerRow + tx / FOG_WORD_BITS] >> (tx % FOG_WORD_BITS)) & 1;
+    }
+    
+    // Recompute the view from the player's tile. Returns true if it was
+    // recomputed (the player changed tiles or the view was invalidated).
+    bool Update(const TileGrid& grid, int playerX, int playerY) {
+        int tile = playerY * tilesX + playerX;
+        if (tile == viewTile) {
+            return false;
+        }
+        viewTile = tile;
+        
+        visible.swap(previous);
+        std::fill(visible.begin(), visible.end(), 0);
+        Mark(playerX, playerY);
+        for (int octant = 0; octant < 8; octant++) {
+            CastOctant(grid, playerX, playerY, 1, 1.0f, 0.0f, octant);
+        }
+        
+        // Whole words at a time: remember what was seen and find the rows
+        // and columns whose bits changed
+        for (int ty = 0; ty < tilesY; ty++) {
+            for (int w = 0; w < wordsPerRow; w++) {
+                int i = ty * wordsPerRow + w;
+                explored[i] |= visible[i];
+                unsigned long long changed = visible[i] ^ previous[i];
+                if (changed == 0) {
+                    continue;
+                }
+                int low = w * FOG_WORD_BITS;
+                int high = low + FOG_WORD_BITS - 1;
+                while (!((changed >> (low % FOG_WORD_BITS)) & 1)) {
+                    low++;
+                }
+                while (!((changed >> (high % FOG_WORD_BITS)) & 1)) {
+                    high--;
+                }
+                dirty.Add(low, ty, high, ty);
+            }
+        }
+        return true;
+    }
+    
+private:
+    // Set a tile's visible bit
+    void Mark(int tx, int ty) {
+        visible[ty * wordsPerRow + tx / FOG_WORD_BITS] |= 1ULL << (tx % FOG_WORD_BITS);
+    }
+    
+    // Recursive shadowcasting over one octant: scan rows outward from the
+    // player and narrow the visible slope range [endSlope, startSlope] at
+    // every solid tile, recursing for the open part beyond it. Solid tiles
+    // that face the player are visible themselves.
+    void CastOctant(const TileGrid& grid, int originX, int originY, int row, float startSlope, float endSlope, int octant) {
+        static const int XX[8] = { 1, 0, 0, -1, -1, 0, 0, 1 };
+        static const int XY[8] = { 0, 1, -1, 0, 0, -1, 1, 0 };
+        static const int YX[8] = { 0, 1, 1, 0, 0, -1, -1, 0 };
+        static const int YY[8] = { 1, 0, 0, 1, -1, 0, 0, -1 };
+        if (startSlope < endSlope) {
+            return;
+        }
+        float nextStart = startSlope;
+        for (int distance = row; distance <= FOG_SIGHT_TILES; distance++) {
+            bool blocked = false;
+            int dy = -distance;
+            for (int dx = -distance; dx <= 0; dx++) {
+                float leftSlope = (dx - 0.5f) / (dy + 0.5f);
+                float rightSlope = (dx + 0.5f) / (dy - 0.5f);
+                if (startSlope < rightSlope) {
+                    continue;
+                }
+                if (endSlope > leftSlope) {
+                    break;
+                }
+                int tx = originX + dx * XX[octant] + dy * XY[octant];
+                int ty = originY + dx * YX[octant] + dy * YY[octant];
+                bool inside = tx >= 0 && ty >= 0 && tx < tilesX && ty < tilesY;
+                if (inside && dx*dx + dy*dy <= FOG_SIGHT_TILES * FOG_SIGHT_TILES) {
+                    Mark(tx, ty);
+                }
+                bool solid = grid.IsSolid(tx, ty);
+                if (blocked) {
+                    if (solid) {
+                        nextStart = rightSlope;
+                        continue;
+                    }
+                    blocked = false;
+                    startSlope = nextStart;
+                } else if (solid && distance < FOG_SIGHT_TILES) {
+                    blocked = true;
+                    CastOctant(grid, originX, originY, distance + 1, startSlope, leftSlope, octant);
+                    nextStart = rightSlope;
+                }
+            }
+            if (blocked) {
+                break;
+            }
+        }
+    }
+};
+
+// copied from main.cpp
+const int LIGHT_CELLS_PER_TILE = 2;    // Static light map resolution (cells per tile side)
+const float LIGHT_CELL_SIZE = TILE_SIZE / LIGHT_CELLS_PER_TILE;
+const int MAX_DYNAMIC_LIGHTS = 32;     // Lights applied per frame; the weakest are dropped
+const int MAX_LIGHT_FLASHES = 64;
+const float LIGHT_SHADE_ALPHA = 150;   // Shade over cells that no light reaches
+const float LAMP_RADIUS = 240.0f;
+const float LAMP_INTENSITY = 0.8f;
+const float LAMP_WALL_DISTANCE = 60.0f;
+const float TORCH_RADIUS = 200.0f;
+const float TORCH_INTENSITY = 0.9f;
+const float MUZZLE_FLASH_RADIUS = 90.0f;
+const float MUZZLE_FLASH_LIFE = 0.06f;
+const float EXPLOSION_FLASH_LIFE = 0.3f;
+
+// A point light with a linear falloff
+struct LightSource {
+    float x;
+    float y;
+    float radius;
+    float intensity;   // Brightness at the centre (0-1)
+};
+
+// A room's lamps baked into a light map with one cell per half tile. Each
+// room keeps its own while its tiles are in memory, so coming back to a
+// room does not bake its lamps again.
+struct StaticLight {
+    std::vector<unsigned char> cells;   // Baked light per cell, empty until baked
+    
+    // Check if the lamps have been baked
+    bool IsBaked() const {
+        return !cells.empty();
+    }
+    
+    // Free the storage (for a room that was streamed out)
+    void Release() {
+        std::vector<unsigned char>().swap(cells);
+    }
+};
+
+// Room lighting. Static lights (the room's lamps) are baked into the room's
+// StaticLight on the first frame in the room; when walls are destroyed only
+// the reach of the lamps around them is baked again. Dynamic lights (the
+// player's torch, muzzle flashes and explosions) use a coarser map with one
+// cell per tile, which is only rebuilt inside the area the lights covered
+// this frame and the last. Tiles cast shadows: a tile is lit if the line
+// from the light's tile to it is clear.
+struct LightMap {
+    float originX;
+    float originY;
+    int tilesX;
+    int tilesY;
+    int cellsX;
+    int cellsY;
+    StaticLight* staticLight;                 // The current room's baked lamps
+    std::vector<unsigned char> dynamicLight;  // This frame's light per tile
+    std::vector<unsigned char> reached;       // Scratch: tiles the current light reaches
+    
+    // Lights for the current frame
+    LightSource lights[MAX_DYNAMIC_LIGHTS];
+    int lightCount;
+    
+    // Short flashes that fade out over their life
+    float flashX[MAX_LIGHT_FLASHES];
+    float flashY[MAX_LIGHT_FLASHES];
+    float flashRadius[MAX_LIGHT_FLASHES];
+    float flashLife[MAX_LIGHT_FLASHES];
+    float flashDuration[MAX_LIGHT_FLASHES];
+    int flashCount;
+    
+    DirtyRect litArea;   // Tiles the dynamic lights covered last frame
+    DirtyRect dirty;     // Cells whose light changed
+    
+    // Constructor
+    LightMap() {
+        originX = 0;
+        originY = 0;
+        tilesX = 0;
+        tilesY = 0;
+        cellsX = 0;
+        cellsY = 0;
+        staticLight = nullptr;
+        lightCount = 0;
+        flashCount = 0;
+    }
+    
+    // Light a room's tile grid with the room's baked lamps (baked later if
+    // the room has none yet) and no dynamic lights
+    void Reset(const TileGrid& grid, StaticLight& roomLight) {
+        originX = grid.originX;
+        originY = grid.originY;
+        tilesX = grid.tilesX;
+        tilesY = grid.tilesY;
+        cellsX = tilesX * LIGHT_CELLS_PER_TILE;
+        cellsY = tilesY * LIGHT_CELLS_PER_TILE;
+        staticLight = &roomLight;
+        dynamicLight.assign(tilesX * tilesY, 0);
+        reached.assign(tilesX * tilesY, 0);
+        lightCount = 0;
+        flashCount = 0;
+        litArea.Clear();
+        dirty.Clear();
+        dirty.Add(0, 0, cellsX - 1, cellsY - 1);
+    }
+    
+    // Check if the room's lamps are baked
+    bool IsBaked() const {
+        return staticLight->IsBaked();
+    }
+    
+    // Bake the static lights into the room's light map
+    void Bake(const TileGrid& grid, const std::vector<LightSource>& lamps) {
+        DirtyRect whole;
+        whole.Add(0, 0, tilesX - 1, tilesY - 1);
+        staticLight->cells.assign(cellsX * cellsY, 0);
+        for (const LightSource& lamp : lamps) {
+            Accumulate(grid, lamp, staticLight->cells, cellsX, LIGHT_CELLS_PER_TILE, whole);
+        }
+        AddDirtyTiles(whole);
+    }
+    
+    // Bake the static lights again after the tiles in a rectangle changed.
+    // Only the reach of the lamps that touch those tiles is redone.
+    void Rebake(const TileGrid& grid, const std::vector<LightSource>& lamps, const DirtyRect& changed) {
+        DirtyRect area;
+        for (const LightSource& lamp : lamps) {
+            DirtyRect reach = Reach(grid, lamp);
+            if (changed.Overlaps(reach.x0, reach.y0, reach.x1, reach.y1)) {
+                area.Add(reach.x0, reach.y0, reach.x1, reach.y1);
+            }
+        }
+        if (area.IsEmpty()) {
+            return;
+        }
+        
+        std::vector<unsigned char>& cells = staticLight->cells;
+        for (int cy = area.y0 * LIGHT_CELLS_PER_TILE; cy < (area.y1 + 1) * LIGHT_CELLS_PER_TILE; cy++) {
+            std::fill(cells.begin() + cy * cellsX + area.x0 * LIGHT_CELLS_PER_TILE,
+                      cells.begin() + cy * cellsX + (area.x1 + 1) * LIGHT_CELLS_PER_TILE, 0);
+        }
+        for (const LightSource& lamp : lamps) {
+            Accumulate(grid, lamp, cells, cellsX, LIGHT_CELLS_PER_TILE, area);
+        }
+        AddDirtyTiles(area);
+    }
+    
+    // Add a light for the current frame. When all slots are in use the
+    // weakest light is replaced, so the cost per frame stays bounded.
+    void AddLight(const LightSource& light) {
+        if (lightCount < MAX_DYNAMIC_LIGHTS) {
+            lights[lightCount++] = light;
+            return;
+        }
+        int weakest = 0;
+        for (int i = 1; i < lightCount; i++) {
+            if (lights[i].radius * lights[i].intensity < lights[weakest].radius * lights[weakest].intensity) {
+                weakest = i;
+            }
+        }
+        if (light.radius * light.intensity > lights[weakest].radius * lights[weakest].intensity) {
+            lights[weakest] = light;
+        }
+    }
+    
+    // Add a flash (dropped when all slots are in use)
+    void AddFlash(float x, float y, float radius, float duration) {
+        if (flashCount >= MAX_LIGHT_FLASHES) {
+            return;
+        }
+        flashX[flashCount] = x;
+        flashY[flashCount] = y;
+        flashRadius[flashCount] = radius;
+        flashLife[flashCount] = duration;
+        flashDuration[flashCount] = duration;
+        flashCount++;
+    }
+    
+    // Age flashes and remove faded ones (swap with the last live flash)
+    void Update(float deltaTime) {
+        for (int i = 0; i < flashCount; ) {
+            flashLife[i] -= deltaTime;
+            if (flashLife[i] <= 0) {
+                flashCount--;
+                flashX[i] = flashX[flashCount];
+                flashY[i] = flashY[flashCount];
+                flashRadius[i] = flashRadius[flashCount];
+                flashLife[i] = flashLife[flashCount];
+                flashDuration[i] = flashDuration[flashCount];
+            } else {
+                i++;
+            }
+        }
+    }
+    
+    // Rebuild the dynamic light map from this frame's lights and flashes,
+    // touching only the tiles lit this frame or the last
+    void UpdateDynamic(const TileGrid& grid) {
+        if (tilesX == 0) {
+            lightCount = 0;
+            return;
+        }
+        for (int i = 0; i < flashCount; i++) {
+            AddLight({ flashX[i], flashY[i], flashRadius[i], flashLife[i] / flashDuration[i] });
+        }
+        
+        // Clear what the previous frame lit
+        if (!litArea.IsEmpty()) {
+            for (int ty = litArea.y0; ty <= litArea.y1; ty++) {
+                std::fill(dynamicLight.begin() + ty * tilesX + litArea.x0, dynamicLight.begin() + ty * tilesX + litArea.x1 + 1, 0);
+            }
+            AddDirtyTiles(litArea);
+        }
+        
+        DirtyRect whole;
+        whole.Add(0, 0, tilesX - 1, tilesY - 1);
+        litArea.Clear();
+        for (int i = 0; i < lightCount; i++) {
+            Accumulate(grid, lights[i], dynamicLight, tilesX, 1, whole);
+            DirtyRect reach = Reach(grid, lights[i]);
+            litArea.Add(reach.x0, reach.y0, reach.x1, reach.y1);
+        }
+        lightCount = 0;
+        if (!litArea.IsEmpty()) {
+            AddDirtyTiles(litArea);
+        }
+    }
+    
+    // Light reaching a cell of the static map (0-255)
+    int Level(int cx, int cy) const {
+        int level = dynamicLight[(cy / LIGHT_CELLS_PER_TILE) * tilesX + cx / LIGHT_CELLS_PER_TILE];
+        if (staticLight->IsBaked()) {
+            level += staticLight->cells[cy * cellsX + cx];
+        }
+        return std::min(level, 255);
+    }
+    
+    // Alpha of the shade drawn over a cell
+    unsigned char Shade(int cx, int cy) const {
+        return (unsigned char)(LIGHT_SHADE_ALPHA * (255 - Level(cx, cy)) / 255);
+    }
+    
+private:
+    // Tiles within a light's radius
+    DirtyRect Reach(const TileGrid& grid, const LightSource& light) const {
+        DirtyRect reach;
+        reach.Add(grid.TileX(light.x - light.radius), grid.TileY(light.y - light.radius),
+                  grid.TileX(light.x + light.radius), grid.TileY(light.y + light.radius));
+        return reach;
+    }
+    
+    // Mark the cells of a rectangle of tiles as changed
+    void AddDirtyTiles(const DirtyRect& area) {
+        dirty.Add(area.x0 * LIGHT_CELLS_PER_TILE, area.y0 * LIGHT_CELLS_PER_TILE,
+                  (area.x1 + 1) * LIGHT_CELLS_PER_TILE - 1, (area.y1 + 1) * LIGHT_CELLS_PER_TILE - 1);
+    }
+    
+    // Add a light to a map with the given number of cells per tile side,
+    // limited to a rectangle of tiles. Shadows are decided per tile, with
+    // one line test per tile in reach.
+    void Accumulate(const TileGrid& grid, const LightSource& light, std::vector<unsigned char>& map, int mapWidth, int cellsPerTile, const DirtyRect& area) {
+        DirtyRect reach = Reach(grid, light);
+        int x0 = std::max(reach.x0, area.x0);
+        int y0 = std::max(reach.y0, area.y0);
+        int x1 = std::min(reach.x1, area.x1);
+        int y1 = std::min(reach.y1, area.y1);
+        int lightX = grid.TileX(light.x);
+        int lightY = grid.TileY(light.y);
+        for (int ty = y0; ty <= y1; ty++) {
+            for (int tx = x0; tx <= x1; tx++) {
+                reached[ty * tilesX + tx] = grid.LineClear(lightX, lightY, tx, ty);
+            }
+        }
+        
+        float cellSize = TILE_SIZE / cellsPerTile;
+        for (int cy = y0 * cellsPerTile; cy < (y1 + 1) * cellsPerTile; cy++) {
+            for (int cx = x0 * cellsPerTile; cx < (x1 + 1) * cellsPerTile; cx++) {
+                if (!reached[(cy / cellsPerTile) * tilesX + cx / cellsPerTile]) {
+                    continue;
+                }
+                float dx = originX + (cx + 0.5f) * cellSize - light.x;
+                float dy = originY + (cy + 0.5f) * cellSize - light.y;
+                float falloff = 1.0f - sqrt(dx*dx + dy*dy) / light.radius;
+                if (falloff <= 0) {
+                    continue;
+                }
+                int level = map[cy * mapWidth + cx] + (int)(255 * light.intensity * falloff);
+                map[cy * mapWidth + cx] = (unsigned char)std::min(level, 255);
+            }
+        }
+    }
+};
+
+// copied from main.cpp
+// Sides of a room that lead to a neighbouring room
+enum RoomExit {
+    EXIT_LEFT = 1,
+    EXIT_RIGHT = 2,
+    EXIT_UP = 4,
+    EXIT_DOWN = 8
+};
+
+const int ROOM_LAYOUTS = 4;             // Pillar layouts shared by the regular rooms
+
+// The part of a room that stays the same for a whole run: its size, pillars,
+// lamps and starting enemies, with positions relative to the room's top
+// left corner. Many rooms are built from one template, and a template is
+// never changed once it is built, so rooms only point to it and keep their
+// own state (enemies, waves, destroyed walls) themselves.
+struct RoomTemplate {
+    float width;
+    float height;
+    bool hasBoss;
+    TileGrid tiles;                      // Laid out at (0, 0)
+    std::vector<LightSource> lamps;
+    std::vector<Vector2> enemySpawns;    // Enemies placed when the dungeon is built
+    
+    // Constructor
+    RoomTemplate(float w, float h, bool boss = false) {
+        width = w;
+        height = h;
+        hasBoss = boss;
+        tiles.Reset(0, 0, width, height);
+    }
+    
+    // Lay out pillars that block movement, shots and sight (none for seed
+    // 0), kept clear of the tiles next to the walls where the player enters,
+    // and lamps near the top and bottom walls where no pillar stands
+    void Layout(unsigned int seed) {
+        tiles.Reset(0, 0, width, height);
+        if (seed != 0) {
+            std::minstd_rand layout(seed);
+            int pillarCount = 2 + layout() % 3;
+            for (int p = 0; p < pillarCount; p++) {
+                int pillarX = 3 + layout() % (tiles.tilesX - 8);
+                int pillarY = 2 + layout() % (tiles.tilesY - 6);
+                int pillarWidth = layout() % 3;
+                int pillarHeight = layout() % 3;
+                tiles.Fill(pillarX, pillarY, pillarX + pillarWidth, pillarY + pillarHeight, TILE_WALL);
+            }
+        }
+        tiles.dirty.Clear();
+        
+        lamps.clear();
+        for (int i = 0; i < 4; i++) {
+            float lampX = width * (i % 2 == 0 ? 0.25f : 0.75f);
+            float lampY = i < 2 ? LAMP_WALL_DISTANCE : height - LAMP_WALL_DISTANCE;
+            if (!tiles.SolidAt(lampX, lampY)) {
+                lamps.push_back({ lampX, lampY, LAMP_RADIUS, LAMP_INTENSITY });
+            }
+        }
+    }
+};
+
+// Room struct for level design
+struct Room {
+    float x;
+    float y;
+    float width;
+    float height;
+    std::shared_ptr<const RoomTemplate> layout;   // Shared with every room built from it
+    std::vector<std::unique_ptr<Enemy>> enemies;
+    bool cleared;
+    std::vector<Wave> waves;  // Grow with the room's depth, so they are not part of the template
+    float waveTime;
+    int waveIndex;
+    int waveSpawned;
+    int waveSquad;        // Squad the current wave is filling, -1 if none
+    size_t spawnCursor;
+    std::unique_ptr<Squads> squads;   // Lent by the squad pool once a formation wave starts
+    int swarmSize;        // Boids released when the player enters
+    int swarmAlive;       // Boids still alive, kept up to date by the game
+    int exits;                // RoomExit flags of the sides with a neighbouring room
+    TileGrid tiles;           // The template's tiles plus this room's damage, built by BuildTiles
+    std::vector<LightSource> lamps;  // The template's lamps placed in the room, built by BuildTiles
+    StaticLight light;        // The lamps baked by the game on the first frame in the room
+    
+    // Constructor for a room built from a shared template
+    Room(float posX, float posY, std::shared_ptr<const RoomTemplate> roomLayout) {
+        Reset(posX, posY, std::move(roomLayout));
+        BuildTiles();
+    }
+    
+    // A room owns its enemies, so it can only be moved. Rooms that look the
+    // same are built from the same template instead of being copied.
+    Room(const Room& other) = delete;
+    Room& operator=(const Room& other) = delete;
+    Room(Room&& other) = default;
+    Room& operator=(Room&& other) = default;
+    
+    // Add enemy to room
+    void AddEnemy(float enemyX, float enemyY, std::mt19937* rng) {
+        enemies.push_back(std::make_unique<Enemy>(enemyX, enemyY, rng));
+    }
+    
+    // Add boss to room
+    void AddBoss(float bossX, float bossY, std::mt19937* rng) {
+        enemies.push_back(std::make_unique<Boss>(bossX, bossY, rng));
+    }
+    
+    // Spawn a regular enemy, reusing a dead one in this room before taking
+    // one from the pool. Returns nullptr if the room or pool is full.
+    Enemy* SpawnEnemy(float enemyX, float enemyY, EnemyPool& pool) {
+        for (size_t n = 0; n < enemies.size(); n++) {
+            size_t i = (spawnCursor + n) % enemies.size();
+            Enemy* enemy = enemies[i].get();
+            if (!enemy->active && !enemy->IsBoss()) {
+                enemy->Respawn(enemyX, enemyY);
+                spawnCursor = i + 1;
+                return enemy;
+            }
+        }
+        
+        if ((int)enemies.size() >= MAX_ROOM_ENEMIES) {
+            return nullptr;
+        }
+        std::unique_ptr<Enemy> enemy = pool.Acquire(enemyX, enemyY);
+        if (!enemy) {
+            return nullptr;
+        }
+        if (enemies.capacity() < MAX_ROOM_ENEMIES) {
+            enemies.reserve(MAX_ROOM_ENEMIES);
+        }
+        enemies.push_back(std::move(enemy));
+        return enemies.back().get();
+    }
+    
+    // Place a pooled boss in the room
+    void SpawnBoss(float bossX, float bossY, EnemyPool& pool, std::mt19937* rng) {
+        enemies.push_back(pool.AcquireBoss(bossX, bossY, rng));
+    }
+    
+    // Return all enemies and squads to their pools (the vector keeps its capacity)
+    void ReleaseEnemies(EnemyPool& pool, SquadPool& squadPool) {
+        for (auto& enemy : enemies) {
+            if (enemy) {
+                pool.Release(std::move(enemy));
+            }
+        }
+        enemies.clear();
+        squadPool.Release(std::move(squads));
+        waveSquad = -1;
+    }
+    
+    // Reinitialize the room in place from a template, keeping its enemy
+    // storage. Enemies and squads must already have been released.
+    void Reset(float posX, float posY, std::shared_ptr<const RoomTemplate> roomLayout) {
+        layout = std::move(roomLayout);
+        x = posX;
+        y = posY;
+        width = layout->width;
+        height = layout->height;
+        cleared = false;
+        waves.clear();
+        waveTime = 0;
+        waveIndex = 0;
+        waveSpawned = 0;
+        waveSquad = -1;
+        spawnCursor = 0;
+        swarmSize = 0;
+        swarmAlive = 0;
+        exits = 0;
+        ReleaseTiles();
+        lamps.clear();
+    }
+    
+    // Place the template's tiles and lamps in the room. Only the rooms
+    // around the player need them, so the room streamer runs this when they
+    // come into reach and puts back the walls this room destroyed.
+    void BuildTiles() {
+        tiles.Place(layout->tiles, x, y);
+        lamps = layout->lamps;
+        for (LightSource& lamp : lamps) {
+            lamp.x += x;
+            lamp.y += y;
+        }
+    }
+    
+    // Free the tiles and the baked lamps (for a room that was streamed out)
+    void ReleaseTiles() {
+        tiles.Release();
+        light.Release();
+    }
+    
+    // Open side the point is about to leave through (closer than margin to
+    // it), or 0 if none
+    int ExitAt(float pointX, float pointY, float margin) const {
+        if ((exits & EXIT_LEFT) && pointX < x + margin) {
+            return EXIT_LEFT;
+        }
+        if ((exits & EXIT_RIGHT) && pointX > x + width - margin) {
+            return EXIT_RIGHT;
+        }
+        if ((exits & EXIT_UP) && pointY < y + margin) {
+            return EXIT_UP;
+        }
+        if ((exits & EXIT_DOWN) && pointY > y + height - margin) {
+            return EXIT_DOWN;
+        }
+        return 0;
+    }
+    
+    // Add a timed wave of enemies (formation -1 spawns them without a squad)
+    void AddWave(float startTime, int count, float interval, int formation = -1) {
+        waves.push_back({ startTime, count, interval, formation });
+    }
+    
+    // Check if every wave has finished spawning
+    bool WavesFinished() const {
+        return waveIndex >= (int)waves.size();
+    }
+    
+    // Advance the wave timer and spawn enemies that are due. The rate scale
+    // speeds up or slows down the wave clock, and spawning pauses while the
+    // room already has activeCap living enemies.
+    void UpdateWaves(float deltaTime, EnemyPool& pool, SquadPool& squadPool, std::mt19937& rng,
+                     float rateScale = 1.0f, int activeCap = MAX_ROOM_ENEMIES) {
+        if (WavesFinished()) {
+            return;
+        }
+        waveTime += deltaTime * rateScale;
+        
+        int activeEnemies = 0;
+        for (const auto& enemy : enemies) {
+            if (enemy->active) {
+                activeEnemies++;
+            }
+        }
+        
+        std::uniform_real_distribution<float> xDist(x + 50, x + width - 50);
+        std::uniform_real_distribution<float> yDist(y + 50, y + height - 50);
+        while (!WavesFinished() && waveTime >= waves[waveIndex].startTime) {
+            const Wave& wave = waves[waveIndex];
+            
+            // Several enemies may be due in one tick at high spawn rates
+            int due = wave.count;
+            if (wave.interval > 0) {
+                due = std::min(wave.count, (int)((waveTime - wave.startTime) / wave.interval) + 1);
+            }
+            while (waveSpawned < due) {
+                if (activeEnemies >= activeCap) {
+                    return; // Room full, retry next tick
+                }
+                
+                // Formation waves fill squads one after another; once the
+                // room runs out of squads the rest roam alone
+                float spawnX = xDist(rng);
+                float spawnY = yDist(rng);
+                if (wave.formation >= 0 && (waveSquad < 0 || !squads->HasSlot(waveSquad))) {
+                    if (!squads) {
+                        squads = squadPool.Acquire();
+                    }
+                    waveSquad = squads ? squads->Create(spawnX, spawnY, wave.formation) : -1;
+                }
+                if (waveSquad >= 0) {
+                    spawnX = squads->NextSlotX(waveSquad);
+                    spawnY = squads->NextSlotY(waveSquad);
+                }
+                
+                Enemy* enemy = SpawnEnemy(spawnX, spawnY, pool);
+                if (!enemy) {
+                    return; // Pool empty, retry next tick
+                }
+                if (waveSquad >= 0) {
+                    enemy->squad = waveSquad;
+                    squads->AddMember(waveSquad, enemy);
+                }
+                activeEnemies++;
+                waveSpawned++;
+            }
+            
+            if (waveSpawned < wave.count) {
+                return;
+            }
+            waveIndex++;
+            waveSpawned = 0;
+            waveSquad = -1;
+        }
+    }
+    
+    // Update room and contained enemies. Regular enemies farther than
+    // lodDistance from the player only think every AI_LOD_STEP seconds,
+    // with the skipped time added to their next update.
+    void Update(float deltaTime, Player* player, float lodDistance = INFINITY) {
+        float lodDistanceSquared = lodDistance * lodDistance;
+        
+        // Move squads as a whole, then pull each member toward its slot
+        // (dead or respawned members leave their squad)
+        if (squads && squads->memberCount > 0) {
+            squads->Update(deltaTime, player->x, player->y, x + SQUAD_SPACING, y + SQUAD_SPACING,
+                           x + width - SQUAD_SPACING, y + height - SQUAD_SPACING);
+            for (int m = 0; m < squads->memberCount; ) {
+                Enemy* enemy = squads->memberEnemy[m];
+                if (!enemy->active || enemy->squad != squads->memberSquad[m]) {
+                    squads->RemoveMember(m);
+                    continue;
+                }
+                float dx = squads->targetX[m] - enemy->x;
+                float dy = squads->targetY[m] - enemy->y;
+                float distance = sqrt(dx*dx + dy*dy);
+                float step = SQUAD_CATCH_UP_SPEED * enemy->speedScale * deltaTime;
+                float move = distance > step ? step / distance : 1.0f;
+                enemy->x += dx * move;
+                enemy->y += dy * move;
+                m++;
+            }
+        }
+        
+        // Update all active enemies
+        for (auto& enemy : enemies) {
+            if (enemy && enemy->active) {
+                enemy->lodTime += deltaTime;
+                float dx = enemy->x - player->x;
+                float dy = enemy->y - player->y;
+                bool far = !enemy->IsBoss() && dx*dx + dy*dy > lodDistanceSquared;
+                if (far && enemy->lodTime < AI_LOD_STEP) {
+                    continue;
+                }
+                enemy->Update(enemy->lodTime, player);
+                enemy->lodTime = 0;
+                
+                // Keep enemies inside room and out of its walls
+                enemy->x = std::max(x + enemy->radius, std::min(enemy->x, x + width - enemy->radius));
+                enemy->y = std::max(y + enemy->radius, std::min(enemy->y, y + height - enemy->radius));
+                tiles.PushOut(enemy->x, enemy->y, enemy->radius);
+            }
+        }
+        
+        // Check if room is cleared (all waves must have spawned and the swarm must be dead)
+        cleared = WavesFinished() && swarmAlive == 0;
+        for (const auto& enemy : enemies) {
+            if (enemy && enemy->active) {
+                cleared = false;
+                break;
+            }
+        }
+    }
+    
+    // Check if a point is inside the room
+    bool ContainsPoint(float pointX, float pointY) {
+        return (pointX >= x && pointX <= x + width && pointY >= y && pointY <= y + height);
+    }
+    
+    // Distance along a normalized ray from a point inside the room to the wall it hits
+    float RayExitDistance(float originX, float originY, float dirX, float dirY) const {
+        float exitX = dirX > 0 ? (x + width - originX) / dirX : dirX < 0 ? (x - originX) / dirX : INFINITY;
+        float exitY = dirY > 0 ? (y + height - originY) / dirY : dirY < 0 ? (y - originY) / dirY : INFINITY;
+        return std::max(0.0f, std::min(exitX, exitY));
+    }
+};
+
+const float GRID_CELL_SIZE = 64.0f; // Must stay larger than any enemy radius for ray casts
+
+// Distance along a normalized ray to where it enters a circle (0 if it starts
+// inside), or INFINITY if it misses, the circle is behind the ray or r is 0
+inline float RayCircleHit(float originX, float originY, float dirX, float dirY, float centerX, float centerY, float r) {
+    float toX = centerX - originX;
+    float toY = centerY - originY;
+    float along = toX * dirX + toY * dirY;
+    float across = toX * toX + toY * toY - along * along;
+    float half = sqrt(std::max(r * r - across, 0.0f));
+    bool hit = r > 0 && across <= r * r && along + half >= 0;
+    return hit ? std::max(along - half, 0.0f) : INFINITY;
+}
+
+// Uniform grid over a room's live enemies (copied from main.cpp)
+struct EnemyGrid {
+    float originX;
+    float originY;
+    int cellsX;
+    int cellsY;
+    std::vector<int> cellStart;   // Offset of each cell's first enemy (one extra entry at the end)
+    std::vector<int> enemyIndex;  // Index into Room::enemies, sorted by cell
+    std::vector<float> enemyX;
+    std::vector<float> enemyY;
+    std::vector<float> enemyRadius;
+    std::vector<int> cellOf;      // Cell of each room enemy, -1 if dead
+    std::vector<int> cursor;
+    std::vector<float> rayT;      // Ray cast scratch: hit distance per sorted enemy
+    std::vector<unsigned char> inRange; // Radius query scratch: overlap flag per sorted enemy
+    std::vector<unsigned int> cellStamp;
+    unsigned int stamp;
+    float maxRadius;
+    int tested;                   // Circle tests run by ray casts since the last build
+    
+    // Constructor
+    EnemyGrid() {
+        originX = 0;
+        originY = 0;
+        cellsX = 0;
+        cellsY = 0;
+        stamp = 0;
+        tested = 0;
+        maxRadius = 0;
+    }
+    
+    // Grid column of a position (positions outside the room use the edge cell)
+    int CellX(float px) const {
+        return std::max(0, std::min((int)((px - originX) / GRID_CELL_SIZE), cellsX - 1));
+    }
+    
+    // Grid row of a position
+    int CellY(float py) const {
+        return std::max(0, std::min((int)((py - originY) / GRID_CELL_SIZE), cellsY - 1));
+    }
+    
+    // Sort the room's live enemies into cells (the buffers only grow, so
+    // rebuilding every tick stops allocating after the largest room)
+    void Build(const Room& room) {
+        originX = room.x;
+        originY = room.y;
+        cellsX = std::max(1, (int)ceil(room.width / GRID_CELL_SIZE));
+        cellsY = std::max(1, (int)ceil(room.height / GRID_CELL_SIZE));
+        int cellCount = cellsX * cellsY;
+        int enemyCount = (int)room.enemies.size();
+        
+        // Count enemies per cell
+        cellStart.assign(cellCount + 1, 0);
+        cellOf.resize(enemyCount);
+        int live = 0;
+        for (int e = 0; e < enemyCount; e++) {
+            const Enemy* enemy = room.enemies[e].get();
+            if (!enemy->active) {
+                cellOf[e] = -1;
+                continue;
+            }
+            cellOf[e] = CellY(enemy->y) * cellsX + CellX(enemy->x);
+            cellStart[cellOf[e] + 1]++;
+            live++;
+        }
+        
+        // Turn the counts into offsets, then scatter enemies into their cells
+        for (int c = 0; c < cellCount; c++) {
+            cellStart[c + 1] += cellStart[c];
+        }
+        cursor.assign(cellStart.begin(), cellStart.end() - 1);
+        enemyIndex.resize(live);
+        enemyX.resize(live);
+        enemyY.resize(live);
+        enemyRadius.resize(live);
+        rayT.resize(live);
+        inRange.resize(live);
+        maxRadius = 0;
+        for (int e = 0; e < enemyCount; e++) {
+            if (cellOf[e] < 0) {
+                continue;
+            }
+            int slot = cursor[cellOf[e]]++;
+            enemyIndex[slot] = e;
+            enemyX[slot] = room.enemies[e]->x;
+            enemyY[slot] = room.enemies[e]->y;
+            enemyRadius[slot] = room.enemies[e]->radius;
+            maxRadius = std::max(maxRadius, enemyRadius[slot]);
+        }
+        
+        cellStamp.assign(cellCount, 0);
+        stamp = 0;
+        tested = 0;
+    }
+    
+    // Index (into Room::enemies) of the nearest live enemy within maxDistance,
+    // or -1. Searches rings of cells outward and stops once no unvisited cell
+    // can hold anything closer than the best enemy found so far.
+    int Nearest(float px, float py, float maxDistance) const {
+        int best = -1;
+        float bestDistance = maxDistance * maxDistance;
+        int cx = CellX(px);
+        int cy = CellY(py);
+        int maxRing = std::max(cellsX, cellsY);
+        
+        for (int ring = 0; ring <= maxRing; ring++) {
+            float bound = (ring - 1) * GRID_CELL_SIZE;
+            if (ring > 0 && bound * bound >= bestDistance) {
+                break;
+            }
+            
+            for (int gy = std::max(cy - ring, 0); gy <= std::min(cy + ring, cellsY - 1); gy++) {
+                // Inner rows only have the two cells on the ring's sides
+                bool edgeRow = gy == cy - ring || gy == cy + ring;
+                int step = edgeRow ? 1 : std::max(1, 2 * ring);
+                for (int gx = cx - ring; gx <= cx + ring; gx += step) {
+                    if (gx < 0 || gx >= cellsX) {
+                        continue;
+                    }
+                    int cell = gy * cellsX + gx;
+                    for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+                        float dx = enemyX[k] - px;
+                        float dy = enemyY[k] - py;
+                        float distance = dx*dx + dy*dy;
+                        if (distance < bestDistance) {
+                            bestDistance = distance;
+                            best = enemyIndex[k];
+                        }
+                    }
+                }
+            }
+        }
+        return best;
+    }
+    
+    // Answer a batch of nearest-enemy queries against the same build
+    void NearestBatch(const float* px, const float* py, int count, float maxDistance, int* result) const {
+        for (int i = 0; i < count; i++) {
+            result[i] = Nearest(px[i], py[i], maxDistance);
+        }
+    }
+    
+    // Cast a normalized ray and collect up to maxHits enemies it crosses within
+    // maxDistance, nearest first. Returns the number of hits written.
+    //
+    // Cells are walked along the ray with a DDA traversal. An enemy can reach
+    // into the ray from the cell next to it, so each walked cell's neighbours
+    // are tested as well (stamped so no cell is tested twice). Anything not
+    // yet tested is then at least a cell away from the ray so far, which lets
+    // the walk stop once the hit list is full and nearer than the cell exit.
+    int CastRay(float rayX, float rayY, float dirX, float dirY, float maxDistance,
+                int maxHits, int* hits, float* hitT) {
+        if (enemyIndex.empty() || maxHits <= 0) {
+            return 0;
+        }
+        if (++stamp == 0) {
+            std::fill(cellStamp.begin(), cellStamp.end(), 0);
+            stamp = 1;
+        }
+        
+        int cx = CellX(rayX);
+        int cy = CellY(rayY);
+        int stepX = dirX > 0 ? 1 : -1;
+        int stepY = dirY > 0 ? 1 : -1;
+        float cellLeft = originX + cx * GRID_CELL_SIZE;
+        float cellTop = originY + cy * GRID_CELL_SIZE;
+        float nextX = dirX != 0 ? ((dirX > 0 ? cellLeft + GRID_CELL_SIZE : cellLeft) - rayX) / dirX : INFINITY;
+        float nextY = dirY != 0 ? ((dirY > 0 ? cellTop + GRID_CELL_SIZE : cellTop) - rayY) / dirY : INFINITY;
+        float deltaX = dirX != 0 ? GRID_CELL_SIZE / fabs(dirX) : INFINITY;
+        float deltaY = dirY != 0 ? GRID_CELL_SIZE / fabs(dirY) : INFINITY;
+        
+        int hitCount = 0;
+        while (true) {
+            // Test this cell and its neighbours
+            for (int gy = std::max(cy - 1, 0); gy <= std::min(cy + 1, cellsY - 1); gy++) {
+                for (int gx = std::max(cx - 1, 0); gx <= std::min(cx + 1, cellsX - 1); gx++) {
+                    int cell = gy * cellsX + gx;
+                    if (cellStamp[cell] == stamp) {
+                        continue;
+                    }
+                    cellStamp[cell] = stamp;
+                    
+                    // Ray-vs-circle over the cell's contiguous slice of enemies
+                    int start = cellStart[cell];
+                    int end = cellStart[cell + 1];
+                    for (int k = start; k < end; k++) {
+                        rayT[k] = RayCircleHit(rayX, rayY, dirX, dirY, enemyX[k], enemyY[k], enemyRadius[k]);
+                    }
+                    tested += end - start;
+                    for (int k = start; k < end; k++) {
+                        if (rayT[k] <= maxDistance) {
+                            InsertHit(enemyIndex[k], rayT[k], maxHits, hits, hitT, hitCount);
+                        }
+                    }
+                }
+            }
+            
+            float cellExit = std::min(nextX, nextY);
+            if ((hitCount == maxHits && hitT[hitCount - 1] <= cellExit) || cellExit >= maxDistance) {
+                break;
+            }
+            
+            // Step into the next cell along the ray
+            if (nextX < nextY) {
+                cx += stepX;
+                nextX += deltaX;
+            } else {
+                cy += stepY;
+                nextY += deltaY;
+            }
+            if (cx < 0 || cx >= cellsX || cy < 0 || cy >= cellsY) {
+                break;
+            }
+        }
+        return hitCount;
+    }
+    
+    // Collect every enemy overlapping a circle into result (indexes into
+    // Room::enemies) and return how many were found. Candidates come from the
+    // cells under the circle's bounding box, widened by the largest enemy
+    // radius; the exact overlap test runs over each cell's contiguous arrays.
+    int QueryRadius(float px, float py, float r, std::vector<int>& result) {
+        result.clear();
+        if (enemyIndex.empty()) {
+            return 0;
+        }
+        
+        float reach = r + maxRadius;
+        int x0 = CellX(px - reach);
+        int x1 = CellX(px + reach);
+        int y0 = CellY(py - reach);
+        int y1 = CellY(py + reach);
+        for (int gy = y0; gy <= y1; gy++) {
+            int start = cellStart[gy * cellsX + x0];
+            int end = cellStart[gy * cellsX + x1 + 1];
+            
+            // A row of cells is one contiguous slice, so filter it in one loop
+            for (int k = start; k < end; k++) {
+                float dx = enemyX[k] - px;
+                float dy = enemyY[k] - py;
+                float limit = r + enemyRadius[k];
+                inRange[k] = (enemyRadius[k] > 0) & (dx*dx + dy*dy < limit * limit);
+            }
+            tested += end - start;
+            for (int k = start; k < end; k++) {
+                if (inRange[k]) {
+                    result.push_back(enemyIndex[k]);
+                }
+            }
+        }
+        return (int)result.size();
+    }
+    
+    // Drop an enemy that died since the build so later ray casts pass through it
+    void Remove(int enemy) {
+        if (enemy >= (int)cellOf.size() || cellOf[enemy] < 0) {
+            return;
+        }
+        int cell = cellOf[enemy];
+        for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+            if (enemyIndex[k] == enemy) {
+                enemyRadius[k] = 0;
+            }
+        }
+    }
+    
+    // Insert a hit into a list kept sorted by distance, dropping the farthest when full
+    static void InsertHit(int enemy, float t, int maxHits, int* hits, float* hitT, int& hitCount) {
+        if (hitCount == maxHits && t >= hitT[hitCount - 1]) {
+            return;
+        }
+        int pos = hitCount < maxHits ? hitCount++ : maxHits - 1;
+        while (pos > 0 && hitT[pos - 1] > t) {
+            hits[pos] = hits[pos - 1];
+            hitT[pos] = hitT[pos - 1];
+            pos--;
+        }
+        hits[pos] = enemy;
+        hitT[pos] = t;
+    }
+};
+
+// copied from main.cpp
+// Pickup types dropped by enemies
+enum PickupType {
+    PICKUP_HEALTH,
+    PICKUP_POWER,
+    PICKUP_TYPES
+};
+
+const int MAX_PICKUPS = 1024;
+const float PICKUP_RADIUS = 8.0f;
+const int PICKUP_HEAL = 15;
+const float POWER_DURATION = 8.0f;
+
+// Dropped pickups in fixed parallel arrays. Pickups never move, so each one
+// is linked into the list of the grid cell it lands in, and collecting only
+// walks the cells around the player instead of every pickup in the room.
+struct PickupPool {
+    float x[MAX_PICKUPS];
+    float y[MAX_PICKUPS];
+    unsigned char type[MAX_PICKUPS];
+    bool active[MAX_PICKUPS];
+    int cellOf[MAX_PICKUPS];
+    int nextInCell[MAX_PICKUPS];
+    int freeSlots[MAX_PICKUPS];
+    int freeCount;
+    int highWater;                // Slots at or above this have never been used
+    int count;
+    std::vector<int> cellHead;    // First pickup in each cell, -1 if empty
+    float originX;
+    float originY;
+    int cellsX;
+    int cellsY;
+    
+    // Constructor
+    PickupPool() {
+        freeCount = 0;
+        highWater = 0;
+        count = 0;
+        originX = 0;
+        originY = 0;
+        cellsX = 0;
+        cellsY = 0;
+    }
+    
+    // Remove all pickups and lay the grid over a room
+    void Reset(const Room& room) {
+        freeCount = 0;
+        highWater = 0;
+        count = 0;
+        originX = room.x;
+        originY = room.y;
+        cellsX = std::max(1, (int)ceil(room.width / GRID_CELL_SIZE));
+        cellsY = std::max(1, (int)ceil(room.height / GRID_CELL_SIZE));
+        cellHead.assign(cellsX * cellsY, -1);
+    }
+    
+    // Grid cell of a position (positions outside the room use the edge cell)
+    int CellOf(float px, float py) const {
+        int cx = std::max(0, std::min((int)((px - originX) / GRID_CELL_SIZE), cellsX - 1));
+        int cy = std::max(0, std::min((int)((py - originY) / GRID_CELL_SIZE), cellsY - 1));
+        return cy * cellsX + cx;
+    }
+    
+    // Drop a pickup; returns false when the pool is full
+    bool Drop(float px, float py, PickupType pickupType) {
+        int slot;
+        if (freeCount > 0) {
+            slot = freeSlots[--freeCount];
+        } else if (highWater < MAX_PICKUPS) {
+            slot = highWater++;
+        } else {
+            return false;
+        }
+        
+        x[slot] = px;
+        y[slot] = py;
+        type[slot] = (unsigned char)pickupType;
+        active[slot] = true;
+        cellOf[slot] = CellOf(px, py);
+        nextInCell[slot] = cellHead[cellOf[slot]];
+        cellHead[cellOf[slot]] = slot;
+        count++;
+        return true;
+    }
+    
+    // Collect every pickup within reach of a point, writing their types to
+    // collected (at most maxCollected). Returns how many were collected.
+    int Collect(float px, float py, float reach, unsigned char* collected, int maxCollected) {
+        if (count == 0) {
+            return 0;
+        }
+        
+        float limit = reach + PICKUP_RADIUS;
+        int x0 = std::max(0, (int)((px - limit - originX) / GRID_CELL_SIZE));
+        int x1 = std::min(cellsX - 1, (int)((px + limit - originX) / GRID_CELL_SIZE));
+        int y0 = std::max(0, (int)((py - limit - originY) / GRID_CELL_SIZE));
+        int y1 = std::min(cellsY - 1, (int)((py + limit - originY) / GRID_CELL_SIZE));
+        
+        int found = 0;
+        for (int cy = y0; cy <= y1; cy++) {
+            for (int cx = x0; cx <= x1; cx++) {
+                // Walk the cell's list, unlinking collected pickups as we go
+                int* link = &cellHead[cy * cellsX + cx];
+                while (*link >= 0 && found < maxCollected) {
+                    int slot = *link;
+                    float dx = x[slot] - px;
+                    float dy = y[slot] - py;
+                    if (dx*dx + dy*dy <= limit * limit) {
+                        collected[found++] = type[slot];
+                        *link = nextInCell[slot];
+                        active[slot] = false;
+                        freeSlots[freeCount++] = slot;
+                        count--;
+                    } else {
+                        link = &nextInCell[slot];
+                    }
+                }
+            }
+        }
+        return found;
+    }
+};
+
+// copied from main.cpp
+// Bullet patterns fired by the boss
+enum BossPatternId {
+    PATTERN_RING,
+    PATTERN_SPIRAL,
+    PATTERN_FLOWER,
+    PATTERN_COUNT
+};
+
+const int MAX_PATTERN_SHOTS = 512;
+const float PATTERN_MUZZLE = 30.0f;
+
+// A boss bullet pattern baked into arrays at startup. Volley v owns the shots
+// [v * shotsPerVolley, (v + 1) * shotsPerVolley); each shot has a spawn
+// offset from the boss and a velocity, so firing a volley is a plain copy.
+struct BossPattern {
+    int volleyCount;
+    int shotsPerVolley;
+    float offsetX[MAX_PATTERN_SHOTS];
+    float offsetY[MAX_PATTERN_SHOTS];
+    float speedX[MAX_PATTERN_SHOTS];
+    float speedY[MAX_PATTERN_SHOTS];
+    
+    // Bake a radial pattern: every volley fires arms shots evenly around the
+    // boss in each ring (later rings are slower and sit half a step over),
+    // turned a further turnPerVolley degrees each volley
+    void BakeRadial(int volleys, int arms, int rings, float turnPerVolley, float speed) {
+        volleyCount = volleys;
+        shotsPerVolley = std::min(arms * rings, MAX_PATTERN_SHOTS / volleys);
+        float step = 2 * PI / arms;
+        for (int v = 0; v < volleys; v++) {
+            for (int k = 0; k < shotsPerVolley; k++) {
+                int ring = k / arms;
+                float angle = (k % arms + ring * 0.5f) * step + v * turnPerVolley * DEG2RAD;
+                float ringSpeed = speed * (1.0f - 0.35f * ring / rings);
+                int shot = v * shotsPerVolley + k;
+                offsetX[shot] = cos(angle) * PATTERN_MUZZLE;
+                offsetY[shot] = sin(angle) * PATTERN_MUZZLE;
+                speedX[shot] = cos(angle) * ringSpeed;
+                speedY[shot] = sin(angle) * ringSpeed;
+            }
+        }
+    }
+};
+
+// Pattern tables (built by BuildBossPatterns once the weapon table is loaded)
+BossPattern bossPatterns[PATTERN_COUNT];
+
+// Precompute every boss pattern for the current BOSS_ORB speed
+void BuildBossPatterns() {
+    float speed = weaponDefs[WEAPON_BOSS_ORB].speed;
+    bossPatterns[PATTERN_RING].BakeRadial(2, 24, 1, 7.5f, speed);
+    bossPatterns[PATTERN_SPIRAL].BakeRadial(36, 4, 1, 10.0f, speed);
+    bossPatterns[PATTERN_FLOWER].BakeRadial(4, 24, 2, 3.75f, speed);
+}
+
+// copied from main.cpp
+const int MAX_SWARM_BOIDS = 256;          // Per room in the game; the benchmark sizes its own swarm
+const float BOID_RADIUS = 4.0f;
+const float BOID_VIEW_RADIUS = 32.0f;     // Neighbours within this distance steer a boid (also the grid cell size)
+const float BOID_SEPARATION = 12.0f;
+const float BOID_MAX_SPEED = 150.0f;
+const float BOID_COHESION = 1.0f;         // Pull toward the neighbours' centre
+const float BOID_ALIGNMENT = 2.0f;        // Pull toward the neighbours' average velocity
+const float BOID_AVOIDANCE = 3000.0f;     // Push away from neighbours closer than BOID_SEPARATION
+const float BOID_ATTRACTION = 220.0f;     // Acceleration toward the target (the player)
+const int BOID_DAMAGE = 2;
+const int BOID_LANES = 8;                 // Neighbours tested together by the steering loop
+
+// Threads that are started once and then run parts of a job together with
+// the calling thread. Between jobs they sleep on a condition variable, so
+// handing out a job costs a wake-up instead of creating and joining threads.
+struct WorkerPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(int, int)>* job;   // Current job, called with a range of items
+    int jobSize;
+    unsigned int jobId;    // Bumped for every job, so each worker takes its part once
+    int pending;           // Workers still running their part of the current job
+    bool stopping;
+    
+    // Constructor
+    WorkerPool() {
+        job = nullptr;
+        jobSize = 0;
+        jobId = 0;
+        pending = 0;
+        stopping = false;
+    }
+    
+    // Destructor
+    ~WorkerPool() {
+        Stop();
+    }
+    
+    // Start the threads; the calling thread counts as one of threadCount
+    void Start(int threadCount) {
+        Stop();
+        stopping = false;
+        for (int part = 1; part < threadCount; part++) {
+            threads.emplace_back(&WorkerPool::WorkerLoop, this, part);
+        }
+    }
+    
+    // Wake the threads up for the last time and wait until they have quit
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    }
+    
+    // Number of threads a job is split across, the calling thread included
+    int ThreadCount() const {
+        return (int)threads.size() + 1;
+    }
+    
+    // Split [0, size) into one range per thread and run the job on every
+    // range; returns once all of them are done
+    void Run(int size, const std::function<void(int, int)>& task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &task;
+            jobSize = size;
+            pending = (int)threads.size();
+            jobId++;
+        }
+        wake.notify_all();
+        RunPart(0);
+        
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return pending == 0; });
+        job = nullptr;
+    }
+    
+private:
+    // Run one thread's range of the current job
+    void RunPart(int part) {
+        int chunk = (jobSize + ThreadCount() - 1) / ThreadCount();
+        int begin = std::min(jobSize, part * chunk);
+        int end = std::min(jobSize, begin + chunk);
+        if (begin < end) {
+            (*job)(begin, end);
+        }
+    }
+    
+    // Worker thread: wait for a job, run its part, report back
+    void WorkerLoop(int part) {
+        unsigned int done = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this, done]() { return stopping || jobId != done; });
+            if (stopping) {
+                break;
+            }
+            done = jobId;
+            lock.unlock();
+            RunPart(part);
+            lock.lock();
+            if (--pending == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+};
+
+// A swarm of small enemies steered by boids rules: separation, alignment,
+// cohesion and attraction to a target. Boids are parallel arrays that are
+// re-sorted by grid cell with a counting sort at the start of every update,
+// so each cell's boids sit next to each other and neighbour queries scan
+// the 3x3 cells around a boid. Steering writes only the boid's own
+// acceleration, so ranges of boids can be steered on a worker pool.
+// Indexes are only stable until the next update; killed boids are dropped
+// when the arrays are re-sorted.
+struct BoidSwarm {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> speedX;
+    std::vector<float> speedY;
+    std::vector<unsigned char> alive;
+    std::vector<float> accelX;
+    std::vector<float> accelY;
+    int count;
+    int aliveCount;
+    
+    // Grid over the swarm's bounds: boids of cell c are [cellStart[c], cellStart[c + 1])
+    float minX;
+    float minY;
+    float maxX;
+    float maxY;
+    int cellsX;
+    int cellsY;
+    std::vector<int> cellStart;
+    std::vector<int> cellCursor;
+    std::vector<int> cellOf;
+    std::vector<float> sortedX;
+    std::vector<float> sortedY;
+    std::vector<float> sortedSpeedX;
+    std::vector<float> sortedSpeedY;
+    
+    // Constructor
+    BoidSwarm() {
+        count = 0;
+        aliveCount = 0;
+        minX = 0;
+        minY = 0;
+        maxX = 0;
+        maxY = 0;
+        cellsX = 0;
+        cellsY = 0;
+    }
+    
+    // Allocate room for a number of boids (done once, outside of updates)
+    void Reserve(int capacity) {
+        x.resize(capacity + BOID_LANES, 0);
+        y.resize(capacity + BOID_LANES, 0);
+        speedX.resize(capacity + BOID_LANES, 0);
+        speedY.resize(capacity + BOID_LANES, 0);
+        alive.resize(capacity);
+        accelX.resize(capacity);
+        accelY.resize(capacity);
+        cellOf.resize(capacity);
+        sortedX.resize(capacity + BOID_LANES, 0);
+        sortedY.resize(capacity + BOID_LANES, 0);
+        sortedSpeedX.resize(capacity + BOID_LANES, 0);
+        sortedSpeedY.resize(capacity + BOID_LANES, 0);
+    }
+    
+    // Remove all boids and confine the swarm to a rectangle
+    void Reset(float left, float top, float right, float bottom) {
+        count = 0;
+        aliveCount = 0;
+        minX = left;
+        minY = top;
+        maxX = right;
+        maxY = bottom;
+        cellsX = std::max(1, (int)ceil((right - left) / BOID_VIEW_RADIUS));
+        cellsY = std::max(1, (int)ceil((bottom - top) / BOID_VIEW_RADIUS));
+        cellStart.assign(cellsX * cellsY + 1, 0);
+        cellCursor.assign(cellsX * cellsY, 0);
+    }
+    
+    // Add a boid; returns false when the reserved space is full
+    bool Spawn(float startX, float startY, float velocityX, float velocityY) {
+        if (count >= (int)alive.size()) {
+            return false;
+        }
+        x[count] = startX;
+        y[count] = startY;
+        speedX[count] = velocityX;
+        speedY[count] = velocityY;
+        alive[count] = 1;
+        accelX[count] = 0;
+        accelY[count] = 0;
+        count++;
+        aliveCount++;
+        // New boids are not in the grid until the next update
+        return true;
+    }
+    
+    // Kill a boid (it stays in the arrays until the next update)
+    void Kill(int i) {
+        if (alive[i]) {
+            alive[i] = 0;
+            aliveCount--;
+        }
+    }
+    
+    // Grid cell coordinates of a position (clamped to the grid)
+    int CellX(float px) const {
+        return std::max(0, std::min((int)((px - minX) / BOID_VIEW_RADIUS), cellsX - 1));
+    }
+    int CellY(float py) const {
+        return std::max(0, std::min((int)((py - minY) / BOID_VIEW_RADIUS), cellsY - 1));
+    }
+    
+    // Drop dead boids and sort the rest by cell with a counting sort
+    void BuildGrid() {
+        std::fill(cellStart.begin(), cellStart.end(), 0);
+        for (int i = 0; i < count; i++) {
+            cellOf[i] = CellY(y[i]) * cellsX + CellX(x[i]);
+            cellStart[cellOf[i] + 1] += alive[i];
+        }
+        for (int c = 0; c < cellsX * cellsY; c++) {
+            cellStart[c + 1] += cellStart[c];
+            cellCursor[c] = cellStart[c];
+        }
+        for (int i = 0; i < count; i++) {
+            if (!alive[i]) {
+                continue;
+            }
+            int k = cellCursor[cellOf[i]]++;
+            sortedX[k] = x[i];
+            sortedY[k] = y[i];
+            sortedSpeedX[k] = speedX[i];
+            sortedSpeedY[k] = speedY[i];
+        }
+        
+        count = aliveCount;
+        x.swap(sortedX);
+        y.swap(sortedY);
+        speedX.swap(sortedSpeedX);
+        speedY.swap(sortedSpeedY);
+        std::fill(alive.begin(), alive.begin() + count, 1);
+    }
+    
+    // Compute the acceleration of boids [begin, end) from their neighbours.
+    // Neighbours are scanned BOID_LANES at a time into separate per-lane
+    // sums with selects instead of branches, so the compiler turns the lane
+    // loop into SIMD instructions without reordering float additions.
+    void Steer(int begin, int end, float targetX, float targetY) {
+        const float viewSquared = BOID_VIEW_RADIUS * BOID_VIEW_RADIUS;
+        const float separationSquared = BOID_SEPARATION * BOID_SEPARATION;
+        for (int k = begin; k < end; k++) {
+            float px = x[k];
+            float py = y[k];
+            int cx = CellX(px);
+            int cy = CellY(py);
+            float neighbours[BOID_LANES] = {};
+            float offsetX[BOID_LANES] = {};
+            float offsetY[BOID_LANES] = {};
+            float velocityX[BOID_LANES] = {};
+            float velocityY[BOID_LANES] = {};
+            float pushX[BOID_LANES] = {};
+            float pushY[BOID_LANES] = {};
+            
+            for (int ny = std::max(cy - 1, 0); ny <= std::min(cy + 1, cellsY - 1); ny++) {
+                // The three cells of a row are contiguous in the sorted arrays
+                int first = cellStart[ny * cellsX + std::max(cx - 1, 0)];
+                int last = cellStart[ny * cellsX + std::min(cx + 1, cellsX - 1) + 1];
+                for (int j = first; j < last; j += BOID_LANES) {
+                    // Lanes past the end of the row read padding and are masked out
+                    for (int l = 0; l < BOID_LANES; l++) {
+                        float dx = x[j + l] - px;
+                        float dy = y[j + l] - py;
+                        float distSquared = dx*dx + dy*dy;
+                        float valid = (j + l < last) & (distSquared > 0) ? 1.0f : 0.0f;
+                        float near = distSquared < viewSquared ? valid : 0.0f;
+                        float close = distSquared < separationSquared ? valid : 0.0f;
+                        float inverse = close / (distSquared + 1.0f);
+                        neighbours[l] += near;
+                        offsetX[l] += near * dx;
+                        offsetY[l] += near * dy;
+                        velocityX[l] += near * speedX[j + l];
+                        velocityY[l] += near * speedY[j + l];
+                        pushX[l] -= inverse * dx;
+                        pushY[l] -= inverse * dy;
+                    }
+                }
+            }
+            
+            for (int l = 1; l < BOID_LANES; l++) {
+                neighbours[0] += neighbours[l];
+                offsetX[0] += offsetX[l];
+                offsetY[0] += offsetY[l];
+                velocityX[0] += velocityX[l];
+                velocityY[0] += velocityY[l];
+                pushX[0] += pushX[l];
+                pushY[0] += pushY[l];
+            }
+            
+            float inverse = neighbours[0] > 0 ? 1.0f / neighbours[0] : 0.0f;
+            float flocking = neighbours[0] > 0 ? 1.0f : 0.0f;
+            float toX = targetX - px;
+            float toY = targetY - py;
+            float toLength = sqrt(toX*toX + toY*toY) + 0.001f;
+            accelX[k] = offsetX[0] * inverse * BOID_COHESION + (velocityX[0] * inverse - speedX[k] * flocking) * BOID_ALIGNMENT +
+                        pushX[0] * BOID_AVOIDANCE + toX / toLength * BOID_ATTRACTION;
+            accelY[k] = offsetY[0] * inverse * BOID_COHESION + (velocityY[0] * inverse - speedY[k] * flocking) * BOID_ALIGNMENT +
+                        pushY[0] * BOID_AVOIDANCE + toY / toLength * BOID_ATTRACTION;
+        }
+    }
+    
+    // Apply accelerations, cap speeds and bounce off the bounds
+    void Integrate(float deltaTime) {
+        const float maxSquared = BOID_MAX_SPEED * BOID_MAX_SPEED;
+        for (int k = 0; k < count; k++) {
+            float vx = speedX[k] + accelX[k] * deltaTime;
+            float vy = speedY[k] + accelY[k] * deltaTime;
+            float speedSquared = vx*vx + vy*vy;
+            float scale = speedSquared > maxSquared ? BOID_MAX_SPEED / sqrt(speedSquared) : 1.0f;
+            vx *= scale;
+            vy *= scale;
+            float nx = x[k] + vx * deltaTime;
+            float ny = y[k] + vy * deltaTime;
+            speedX[k] = (nx < minX) ? fabs(vx) : (nx > maxX) ? -fabs(vx) : vx;
+            speedY[k] = (ny < minY) ? fabs(vy) : (ny > maxY) ? -fabs(vy) : vy;
+            x[k] = std::max(minX, std::min(nx, maxX));
+            y[k] = std::max(minY, std::min(ny, maxY));
+        }
+    }
+    
+    // Advance the swarm toward a target. With a worker pool the steering
+    // pass is split into equal ranges of boids, one per thread.
+    void Update(float deltaTime, float targetX, float targetY, WorkerPool* workers = nullptr) {
+        BuildGrid();
+        if (!workers || count < workers->ThreadCount() * 256) {
+            Steer(0, count, targetX, targetY);
+        } else {
+            workers->Run(count, [this, targetX, targetY](int begin, int end) {
+                Steer(begin, end, targetX, targetY);
+            });
+        }
+        Integrate(deltaTime);
+    }
+    
+    // Find a live boid within reach of a point (reach must stay below the
+    // cell size); returns its index or -1
+    int FindHit(float px, float py, float reach) const {
+        int cx = CellX(px);
+        int cy = CellY(py);
+        for (int ny = std::max(cy - 1, 0); ny <= std::min(cy + 1, cellsY - 1); ny++) {
+            int first = cellStart[ny * cellsX + std::max(cx - 1, 0)];
+            int last = cellStart[ny * cellsX + std::min(cx + 1, cellsX - 1) + 1];
+            for (int j = first; j < last; j++) {
+                float dx = x[j] - px;
+                float dy = y[j] - py;
+                if (alive[j] && dx*dx + dy*dy < reach * reach) {
+                    return j;
+                }
+            }
+        }
+        return -1;
+    }
+    
+    // Kill every live boid within a radius; returns how many died
+    int KillInRadius(float px, float py, float r) {
+        int killed = 0;
+        for (int ny = CellY(py - r - BOID_VIEW_RADIUS); ny <= CellY(py + r + BOID_VIEW_RADIUS); ny++) {
+            int first = cellStart[ny * cellsX + CellX(px - r - BOID_VIEW_RADIUS)];
+            int last = cellStart[ny * cellsX + CellX(px + r + BOID_VIEW_RADIUS) + 1];
+            for (int j = first; j < last; j++) {
+                float dx = x[j] - px;
+                float dy = y[j] - py;
+                if (alive[j] && dx*dx + dy*dy < r * r) {
+                    Kill(j);
+                    killed++;
+                }
+            }
+        }
+        return killed;
+    }
+};
+
+// copied from main.cpp
+// Where the rooms of a run sit on the dungeon grid. Rooms fill the rows of a
+// square grid like a snake (left to right, then right to left), so every
+// room lies next to the one before it. Only rooms that follow each other are
+// connected: a run is one path through every room, with the boss room at
+// its end.
+struct DungeonGrid {
+    int count;      // Rooms on the grid
+    int columns;    // Rooms per row
+    
+    // Constructor
+    DungeonGrid() {
+        Resize(0);
+    }
+    
+    // Lay out a number of rooms
+    void Resize(int roomCount) {
+        count = roomCount;
+        columns = std::max(1, (int)ceil(sqrt((float)roomCount)));
+    }
+    
+    // Grid row of a room
+    int Row(int room) const {
+        return room / columns;
+    }
+    
+    // Grid column of a room (odd rows run right to left)
+    int Column(int room) const {
+        int column = room % columns;
+        return Row(room) % 2 == 0 ? column : columns - 1 - column;
+    }
+    
+    // Index of the room through an exit of another room, or -1 if there is none
+    int Neighbour(int room, int exit) const {
+        int row = Row(room);
+        int column = Column(room);
+        switch (exit) {
+            case EXIT_LEFT:
+                column--;
+                break;
+            case EXIT_RIGHT:
+                column++;
+                break;
+            case EXIT_UP:
+                row--;
+                break;
+            case EXIT_DOWN:
+                row++;
+                break;
+            default:
+                return -1;
+        }
+        if (row < 0 || column < 0 || column >= columns) {
+            return -1;
+        }
+        int other = row * columns + (row % 2 == 0 ? column : columns - 1 - column);
+        return other < count && abs(other - room) == 1 ? other : -1;
+    }
+};
+
+// Everything a run is built from: the rooms, their enemy pool and the
+// simulation RNG that the enemies point to. The game keeps two, so the next
+// run can be built on a worker thread while the current one is still shown.
+struct Dungeon {
+    std::vector<Room> rooms;
+    std::vector<std::shared_ptr<const RoomTemplate>> templates;   // ROOM_LAYOUTS regular rooms, the open first room, the boss room
+    EnemyPool enemyPool;
+    SquadPool squadPool;
+    std::mt19937 rng;
+    unsigned int seed;
+    DungeonGrid grid;
+    
+    // Constructor
+    Dungeon() {
+        seed = 0;
+    }
+    
+    // Enemies keep a pointer to rng, so a dungeon must never be copied or moved
+    Dungeon(const Dungeon& other) = delete;
+    Dungeon& operator=(const Dungeon& other) = delete;
+    
+    // Build a run in place; the same seed always builds the same dungeon.
+    // Rooms and enemies are reused from the previous build.
+    void Build(unsigned int runSeed, int roomCount) {
+        seed = runSeed;
+        
+        // Return every enemy to the pool and make sure the pool covers every
+        // room (before seeding, so new allocations don't shift the sequence)
+        for (auto& room : rooms) {
+            room.ReleaseEnemies(enemyPool, squadPool);
+        }
+        enemyPool.Preallocate(std::max(ENEMY_POOL_SIZE, roomCount * 6 + MAX_ROOM_ENEMIES), &rng);
+        squadPool.Preallocate(SQUAD_POOL_SIZE);
+        rng.seed(runSeed);
+        
+        // Templates are built again for the new seed as rooms ask for them
+        templates.assign(ROOM_LAYOUTS + 2, nullptr);
+        
+        // Only create or remove rooms when the dungeon size changed
+        while ((int)rooms.size() > roomCount) {
+            rooms.pop_back();
+        }
+        while ((int)rooms.size() < roomCount) {
+            rooms.emplace_back(0, 0, Template(0, true, false));
+        }
+        
+        // Each side that leads to the room before or after is an exit
+        grid.Resize(roomCount);
+        for (int i = 0; i < roomCount; i++) {
+            bool isBossRoom = (i == roomCount - 1); // Last room has boss
+            int variant = isBossRoom ? 0 : rng() % ROOM_LAYOUTS;
+            
+            // Reinitialize the room at its place on the grid
+            Room& room = rooms[i];
+            float roomX = grid.Column(i) * 800.0f;
+            float roomY = grid.Row(i) * 600.0f;
+            room.Reset(roomX, roomY, Template(variant, i == 0, isBossRoom));
+            room.exits = (Neighbour(i, EXIT_LEFT) >= 0 ? EXIT_LEFT : 0) | (Neighbour(i, EXIT_RIGHT) >= 0 ? EXIT_RIGHT : 0) |
+                         (Neighbour(i, EXIT_UP) >= 0 ? EXIT_UP : 0) | (Neighbour(i, EXIT_DOWN) >= 0 ? EXIT_DOWN : 0);
+            
+            for (const Vector2& spawn : room.layout->enemySpawns) {
+                room.SpawnEnemy(roomX + spawn.x, roomY + spawn.y, enemyPool);
+            }
+            if (room.layout->hasBoss) {
+                room.SpawnBoss(roomX + room.width / 2, roomY + room.height / 2, enemyPool, &rng);
+                continue;
+            }
+            
+            // Later rooms send timed reinforcement waves, and from the
+            // third room on a swarm waits inside
+            if (i > 0) {
+                room.AddWave(6.0f, std::min(2 + i, 12), 0.75f);
+                room.AddWave(14.0f, std::min(3 + i, 16), 0, i % FORMATION_COUNT);
+            }
+            if (i > 1) {
+                room.swarmSize = std::min(20 + 5 * i, MAX_SWARM_BOIDS);
+            }
+        }
+    }
+    
+    // Template shared by the regular rooms that use one of the layouts (or
+    // by the open first room, or the boss room), built the first time a room
+    // asks for it. It only depends on the run seed, so the order rooms ask
+    // in doesn't matter.
+    std::shared_ptr<const RoomTemplate> Template(int variant, bool open, bool boss) {
+        int key = boss ? ROOM_LAYOUTS + 1 : (open ? ROOM_LAYOUTS : variant);
+        if (templates[key]) {
+            return templates[key];
+        }
+        
+        std::shared_ptr<RoomTemplate> layout = std::make_shared<RoomTemplate>(800, 600, boss);
+        std::minstd_rand spawns(seed ^ (key * 2654435761u));
+        
+        // The first room has no pillars
+        layout->Layout(!open && !boss ? spawns() | 1 : 0);
+        if (!boss) {
+            // Regular room with random enemies
+            int enemyCount = 3 + spawns() % 4;
+            for (int j = 0; j < enemyCount; j++) {
+                float spawnX = 100 + spawns() % 600;
+                float spawnY = 100 + spawns() % 400;
+                layout->enemySpawns.push_back({ spawnX, spawnY });
+            }
+        }
+        templates[key] = layout;
+        return layout;
+    }
+    
+    // Index of the room through an exit of another room, or -1 if there is none
+    int Neighbour(int room, int exit) const {
+        return grid.Neighbour(room, exit);
+    }
+};
+
+// copied from main.cpp
+const size_t ROOM_CACHE_BYTES = 64 * 1024;   // Memory cap of the room cache
+
+// What the rooms that were streamed out changed in their template's tiles:
+// three bytes per tile that differs, its index and its value (0 for floor,
+// the hit points left for walls). Rooms whose walls are untouched need no
+// entry. Entries are kept in least recently used order; past the memory cap
+// the oldest are dropped, and such a room gets its template's walls back
+// when it comes into reach again.
+struct RoomCache {
+    struct Entry {
+        int room;
+        std::vector<unsigned char> data;
+    };
+    std::list<Entry> entries;                                     // Most recently stored first
+    std::unordered_map<int, std::list<Entry>::iterator> lookup;   // Room index to entry
+    size_t bytes;
+    size_t capacity;
+    
+    // Constructor
+    RoomCache() {
+        bytes = 0;
+        capacity = ROOM_CACHE_BYTES;
+    }
+    
+    // Drop every entry
+    void Clear() {
+        entries.clear();
+        lookup.clear();
+        bytes = 0;
+    }
+    
+    // Memory charged for an entry
+    static size_t EntryBytes(const Entry& entry) {
+        return sizeof(Entry) + entry.data.size();
+    }
+    
+    // Encoded value of a tile (walls keep at least 1 hit point)
+    static unsigned char TileValue(const TileGrid& grid, int i) {
+        return grid.tiles[i] == TILE_FLOOR ? 0 : std::max<unsigned char>(grid.health[i], 1);
+    }
+    
+    // Store how a room's tiles differ from its template's, dropping the
+    // least recently stored rooms while the cache is over its cap
+    void Store(int room, const TileGrid& grid, const TileGrid& base) {
+        Remove(room);
+        std::vector<unsigned char> data;
+        int count = std::min(grid.tilesX * grid.tilesY, base.tilesX * base.tilesY);
+        for (int i = 0; i < count; i++) {
+            unsigned char value = TileValue(grid, i);
+            if (value != TileValue(base, i)) {
+                data.push_back((unsigned char)(i & 0xFF));
+                data.push_back((unsigned char)(i >> 8));
+                data.push_back(value);
+            }
+        }
+        if (data.empty()) {
+            return;
+        }
+        entries.push_front({ room, std::move(data) });
+        lookup[room] = entries.begin();
+        bytes += EntryBytes(entries.front());
+        
+        while (bytes > capacity && !entries.empty()) {
+            bytes -= EntryBytes(entries.back());
+            lookup.erase(entries.back().room);
+            entries.pop_back();
+        }
+    }
+    
+    // Put a room's changes back over a grid placed from its template and
+    // take the entry out of the cache. Returns false if the room is not cached.
+    bool Restore(int room, TileGrid& grid) {
+        auto found = lookup.find(room);
+        if (found == lookup.end()) {
+            return false;
+        }
+        const std::vector<unsigned char>& data = found->second->data;
+        int count = grid.tilesX * grid.tilesY;
+        for (size_t k = 0; k + 2 < data.size(); k += 3) {
+            int i = data[k] | data[k + 1] << 8;
+            if (i < count) {
+                grid.tiles[i] = data[k + 2] == 0 ? TILE_FLOOR : TILE_WALL;
+                grid.health[i] = data[k + 2];
+                grid.dirty.Add(i % grid.tilesX, i / grid.tilesX, i % grid.tilesX, i / grid.tilesX);
+            }
+        }
+        Remove(room);
+        return true;
+    }
+    
+    // Drop a room's entry if there is one
+    void Remove(int room) {
+        auto found = lookup.find(room);
+        if (found == lookup.end()) {
+            return;
+        }
+        bytes -= EntryBytes(*found->second);
+        entries.erase(found->second);
+        lookup.erase(found);
+    }
+};
+
+// copied from main.cpp
+// Replay file header
+const char REPLAY_MAGIC[4] = { 'T', 'D', 'S', 'R' };
+const unsigned int REPLAY_VERSION = 21; // Bump whenever simulation rules change
+const char* const REPLAY_DIRECTORY = "replays";
+
+// Replay of a single run: the RNG seed plus the delta time and input flags
+// of every tick, which is enough to re-simulate the run deterministically
+// with the same weapon table
+struct Replay {
+    unsigned int seed;
+    unsigned int weaponHash;   // HashWeaponDefs() when the run was recorded
+    std::vector<float> deltaTimes;
+    std::vector<unsigned char> inputs;
+    
+    // Constructor
+    Replay() {
+        seed = 0;
+        weaponHash = 0;
+    }
+    
+    // Start a new recording
+    void Clear(unsigned int runSeed) {
+        seed = runSeed;
+        weaponHash = HashWeaponDefs();
+        deltaTimes.clear();
+        inputs.clear();
+    }
+    
+    // Append one tick
+    void Record(float deltaTime, unsigned char input) {
+        deltaTimes.push_back(deltaTime);
+        inputs.push_back(input);
+    }
+    
+    // Number of recorded ticks
+    size_t TickCount() const {
+        return inputs.size();
+    }
+    
+    // Write replay to disk (header, then all delta times, then all inputs)
+    bool Save(const char* fileName) const {
+        FILE* file = fopen(fileName, "wb");
+        if (!file) {
+            return false;
+        }
+        
+        unsigned int tickCount = (unsigned int)TickCount();
+        bool ok = fwrite(REPLAY_MAGIC, 1, 4, file) == 4 &&
+                  fwrite(&REPLAY_VERSION, sizeof(REPLAY_VERSION), 1, file) == 1 &&
+                  fwrite(&seed, sizeof(seed), 1, file) == 1 &&
+                  fwrite(&weaponHash, sizeof(weaponHash), 1, file) == 1 &&
+                  fwrite(&tickCount, sizeof(tickCount), 1, file) == 1 &&
+                  fwrite(deltaTimes.data(), sizeof(float), tickCount, file) == tickCount &&
+                  fwrite(inputs.data(), 1, tickCount, file) == tickCount;
+        fclose(file);
+        return ok;
+    }
+    
+    // Read replay from disk, reusing the existing buffers. Replays recorded
+    // with another weapon table are rejected.
+    bool Load(const char* fileName) {
+        FILE* file = fopen(fileName, "rb");
+        if (!file) {
+            return false;
+        }
+        
+        char magic[4];
+        unsigned int version = 0;
+        unsigned int tickCount = 0;
+        bool ok = fread(magic, 1, 4, file) == 4 &&
+                  memcmp(magic, REPLAY_MAGIC, 4) == 0 &&
+                  fread(&version, sizeof(version), 1, file) == 1 &&
+                  version == REPLAY_VERSION &&
+                  fread(&seed, sizeof(seed), 1, file) == 1 &&
+                  fread(&weaponHash, sizeof(weaponHash), 1, file) == 1 &&
+                  weaponHash == HashWeaponDefs() &&
+                  fread(&tickCount, sizeof(tickCount), 1, file) == 1;
+        
+        // The tick count comes from the file, so check that the rest of the
+        // file can hold that many ticks before sizing the buffers
+        if (ok) {
+            long dataStart = ftell(file);
+            ok = dataStart >= 0 && fseek(file, 0, SEEK_END) == 0;
+            long dataEnd = ok ? ftell(file) : -1;
+            ok = ok && dataEnd >= dataStart && fseek(file, dataStart, SEEK_SET) == 0 &&
+                 (unsigned long long)tickCount * (sizeof(float) + 1) <= (unsigned long long)(dataEnd - dataStart);
+        }
+        
+        if (ok) {
+            deltaTimes.resize(tickCount);
+            inputs.resize(tickCount);
+            ok = fread(deltaTimes.data(), sizeof(float), tickCount, file) == tickCount &&
+                 fread(inputs.data(), 1, tickCount, file) == tickCount;
+        }
+        
+        fclose(file);
+        return ok;
+    }
+};
+
+// copied from main.cpp
+// Columns of the per-tick telemetry log
+enum TelemetryColumn {
+    COL_TICK,
+    COL_ROOM,
+    COL_TICK_US,
+    COL_PLAYER_US,
+    COL_SHOOTING_US,
+    COL_PROJECTILES_US,
+    COL_ROOM_US,
+    COL_FRAME_MS,
+    COL_ENEMIES,
+    COL_PROJECTILES,
+    COL_COLLISIONS,
+    COL_COUNT
+};
+
+// Column names and types as written into the file header
+const char* const TELEMETRY_COLUMN_NAMES[COL_COUNT] = {
+    "tick", "room", "tick_us", "player_us", "shooting_us", "projectiles_us",
+    "room_us", "frame_ms", "enemies", "projectiles", "collisions"
+};
+const bool TELEMETRY_COLUMN_IS_FLOAT[COL_COUNT] = {
+    false, false, true, true, true, true, true, true, false, false, false
+};
+
+// Rows per compressed block and number of blocks buffered for the writer
+const int TELEMETRY_BLOCK_ROWS = 4096;
+const int TELEMETRY_BLOCK_COUNT = 4;
+const char TELEMETRY_MAGIC[4] = { 'T', 'D', 'T', 'L' };
+const char TELEMETRY_BLOCK_MAGIC[4] = { 'T', 'D', 'T', 'B' };
+
+// One block of telemetry rows stored column by column (every value is 32 bits,
+// floats are stored by bit pattern)
+struct TelemetryBlock {
+    int rows;
+    std::vector<unsigned int> columns[COL_COUNT];
+    
+    // Constructor
+    TelemetryBlock() {
+        rows = 0;
+        for (int i = 0; i < COL_COUNT; i++) {
+            columns[i].resize(TELEMETRY_BLOCK_ROWS);
+        }
+    }
+    
+    // Store an integer value
+    void SetInt(int column, unsigned int value) {
+        columns[column][rows] = value;
+    }
+    
+    // Store a float value
+    void SetFloat(int column, float value) {
+        memcpy(&columns[column][rows], &value, sizeof(float));
+    }
+};
+
+// Append-only columnar telemetry file. The game fills blocks in memory and a
+// background thread compresses and writes full blocks, so ticks never wait on disk.
+class TelemetryLog {
+private:
+    FILE* file;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<TelemetryBlock*> freeBlocks;
+    std::vector<TelemetryBlock*> pendingBlocks;
+    TelemetryBlock* current;
+    bool stopping;
+    unsigned long long droppedRows;
+    
+    // Background thread: compress and append pending blocks
+    void WriterLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this]() { return stopping || !pendingBlocks.empty(); });
+            if (pendingBlocks.empty()) {
+                break;
+            }
+            TelemetryBlock* block = pendingBlocks.front();
+            pendingBlocks.erase(pendingBlocks.begin());
+            
+            lock.unlock();
+            WriteBlock(*block);
+            lock.lock();
+            
+            block->rows = 0;
+            freeBlocks.push_back(block);
+        }
+    }
+    
+    // Compress each column separately and append the block to the file
+    void WriteBlock(const TelemetryBlock& block) {
+        int rows = block.rows;
+        fwrite(TELEMETRY_BLOCK_MAGIC, 1, 4, file);
+        fwrite(&rows, sizeof(rows), 1, file);
+        
+        for (int i = 0; i < COL_COUNT; i++) {
+            int compressedSize = 0;
+            unsigned char* compressed = CompressData((const unsigned char*)block.columns[i].data(),
+                                                     rows * (int)sizeof(unsigned int), &compressedSize);
+            fwrite(&compressedSize, sizeof(compressedSize), 1, file);
+            fwrite(compressed, 1, compressedSize, file);
+            MemFree(compressed);
+        }
+        fflush(file);
+    }
+    
+public:
+    // Constructor
+    TelemetryLog() {
+        file = nullptr;
+        current = nullptr;
+        stopping = false;
+        droppedRows = 0;
+    }
+    
+    // Destructor
+    ~TelemetryLog() {
+        Close();
+        for (auto block : freeBlocks) {
+            delete block;
+        }
+        delete current;
+    }
+    
+    // Create the file, write the header and start the writer thread
+    bool Open(const char* fileName) {
+        file = fopen(fileName, "wb");
+        if (!file) {
+            return false;
+        }
+        
+        unsigned int version = 1;
+        int columnCount = COL_COUNT;
+        fwrite(TELEMETRY_MAGIC, 1, 4, file);
+        fwrite(&version, sizeof(version), 1, file);
+        fwrite(&columnCount, sizeof(columnCount), 1, file);
+        for (int i = 0; i < COL_COUNT; i++) {
+            char name[16] = { 0 };
+            strncpy(name, TELEMETRY_COLUMN_NAMES[i], sizeof(name) - 1);
+            unsigned char isFloat = TELEMETRY_COLUMN_IS_FLOAT[i] ? 1 : 0;
+            fwrite(name, 1, sizeof(name), file);
+            fwrite(&isFloat, 1, 1, file);
+        }
+        
+        // Preallocate every block up front
+        current = new TelemetryBlock();
+        for (int i = 1; i < TELEMETRY_BLOCK_COUNT; i++) {
+            freeBlocks.push_back(new TelemetryBlock());
+        }
+        
+        stopping = false;
+        writer = std::thread(&TelemetryLog::WriterLoop, this);
+        return true;
+    }
+    
+    // Block being filled by the game; call Commit after setting the row's values
+    TelemetryBlock* Row() {
+        return current;
+    }
+    
+    // Finish the current row, handing the block to the writer when it is full
+    void Commit() {
+        if (!current) {
+            return;
+        }
+        current->rows++;
+        if (current->rows < TELEMETRY_BLOCK_ROWS) {
+            return;
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        if (freeBlocks.empty()) {
+            // Writer is behind: drop this block rather than stall the game
+            droppedRows += current->rows;
+            current->rows = 0;
+            return;
+        }
+        pendingBlocks.push_back(current);
+        current = freeBlocks.back();
+        freeBlocks.pop_back();
+        wake.notify_one();
+    }
+    
+    // Flush the partial block, stop the writer and close the file
+    void Close() {
+        if (!file) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (current && current->rows > 0) {
+                pendingBlocks.push_back(current);
+                current = nullptr;
+            }
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        fclose(file);
+        file = nullptr;
+        
+        if (droppedRows > 0) {
+            printf("Telemetry: dropped %llu rows because the writer fell behind\n", droppedRows);
+        }
+    }
+};
+
+// copied from main.cpp
+// Reads a telemetry file block by block, decompressing only the columns a query needs
+struct TelemetryReader {
+    FILE* file;
+    long fileSize;
+    std::vector<std::string> names;
+    std::vector<bool> isFloat;
+    
+    // Constructor
+    TelemetryReader() {
+        file = nullptr;
+        fileSize = 0;
+    }
+    
+    // Destructor
+    ~TelemetryReader() {
+        if (file) {
+            fclose(file);
+        }
+    }
+    
+    // Open a file and read its column schema
+    bool Open(const char* fileName) {
+        file = fopen(fileName, "rb");
+        if (!file || fseek(file, 0, SEEK_END) != 0 || (fileSize = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+            return false;
+        }
+        
+        char magic[4];
+        unsigned int version = 0;
+        int columnCount = 0;
+        if (fread(magic, 1, 4, file) != 4 || memcmp(magic, TELEMETRY_MAGIC, 4) != 0 ||
+            fread(&version, sizeof(version), 1, file) != 1 || version != 1 ||
+            fread(&columnCount, sizeof(columnCount), 1, file) != 1) {
+            return false;
+        }
+        
+        for (int i = 0; i < columnCount; i++) {
+            char name[17] = { 0 };
+            unsigned char floatFlag = 0;
+            if (fread(name, 1, 16, file) != 16 || fread(&floatFlag, 1, 1, file) != 1) {
+                return false;
+            }
+            names.push_back(name);
+            isFloat.push_back(floatFlag != 0);
+        }
+        return true;
+    }
+    
+    // Look up a column by name (-1 if missing)
+    int FindColumn(const char* name) const {
+        for (size_t i = 0; i < names.size(); i++) {
+            if (names[i] == name) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+    
+    // Bytes between the read position and the end of the file
+    long Remaining() const {
+        long position = ftell(file);
+        return position < 0 ? 0 : fileSize - position;
+    }
+    
+    // Read the next block, converting the wanted columns to floats (others are skipped).
+    // Returns the number of rows, 0 at the end of the file, or -1 if the block
+    // is truncated or corrupt. Sizes in the file are checked before they are used.
+    int ReadBlock(const std::vector<bool>& wanted, std::vector<std::vector<float>>& values) {
+        char magic[4];
+        int rows = 0;
+        size_t magicRead = fread(magic, 1, 4, file);
+        if (magicRead == 0 && feof(file)) {
+            return 0;
+        }
+        if (magicRead != 4 || memcmp(magic, TELEMETRY_BLOCK_MAGIC, 4) != 0 ||
+            fread(&rows, sizeof(rows), 1, file) != 1 || rows < 1 || rows > TELEMETRY_BLOCK_ROWS) {
+            return -1;
+        }
+        
+        values.resize(names.size());
+        std::vector<unsigned char> compressed;
+        for (size_t column = 0; column < names.size(); column++) {
+            int compressedSize = 0;
+            if (fread(&compressedSize, sizeof(compressedSize), 1, file) != 1 ||
+                compressedSize < 0 || compressedSize > Remaining()) {
+                return -1;
+            }
+            if (!wanted[column]) {
+                if (fseek(file, compressedSize, SEEK_CUR) != 0) {
+                    return -1;
+                }
+                continue;
+            }
+            
+            compressed.resize(compressedSize);
+            if (fread(compressed.data(), 1, compressedSize, file) != (size_t)compressedSize) {
+                return -1;
+            }
+            int rawSize = 0;
+            unsigned char* raw = DecompressData(compressed.data(), compressedSize, &rawSize);
+            if (!raw || rawSize != rows * (int)sizeof(unsigned int)) {
+                MemFree(raw);
+                return -1;
+            }
+            
+            std::vector<float>& out = values[column];
+            out.resize(rows);
+            if (isFloat[column]) {
+                memcpy(out.data(), raw, rawSize);
+            } else {
+                const unsigned int* ints = (const unsigned int*)raw;
+                for (int i = 0; i < rows; i++) {
+                    out[i] = (float)ints[i];
+                }
+            }
+            MemFree(raw);
+        }
+        return rows;
+    }
+};
+
+// Comparison used by a telemetry query filter
+enum FilterOp {
+    FILTER_NONE,
+    FILTER_LESS,
+    FILTER_LESS_EQUAL,
+    FILTER_GREATER,
+    FILTER_GREATER_EQUAL,
+    FILTER_EQUAL
+};
+
+// Evaluate a filter over a whole column at once. Each case is a plain loop
+// without branches in the body, so the compiler vectorizes it.
+void ScanFilter(const float* column, int rows, FilterOp op, float value, unsigned char* mask) {
+    switch (op) {
+        case FILTER_NONE:
+            for (int i = 0; i < rows; i++) mask[i] = 1;
+            break;
+        case FILTER_LESS:
+            for (int i = 0; i < rows; i++) mask[i] = column[i] < value;
+            break;
+        case FILTER_LESS_EQUAL:
+            for (int i = 0; i < rows; i++) mask[i] = column[i] <= value;
+            break;
+        case FILTER_GREATER:
+            for (int i = 0; i < rows; i++) mask[i] = column[i] > value;
+            break;
+        case FILTER_GREATER_EQUAL:
+            for (int i = 0; i < rows; i++) mask[i] = column[i] >= value;
+            break;
+        case FILTER_EQUAL:
+            for (int i = 0; i < rows; i++) mask[i] = column[i] == value;
+            break;
+    }
+}
+
+// Parse a filter operator ("<", "<=", ">", ">=", "=="). Returns false for
+// anything else, so a typo never turns into a query over every row.
+bool ParseFilterOp(const char* text, FilterOp& op) {
+    if (strcmp(text, "<") == 0) op = FILTER_LESS;
+    else if (strcmp(text, "<=") == 0) op = FILTER_LESS_EQUAL;
+    else if (strcmp(text, ">") == 0) op = FILTER_GREATER;
+    else if (strcmp(text, ">=") == 0) op = FILTER_GREATER_EQUAL;
+    else if (strcmp(text, "==") == 0) op = FILTER_EQUAL;
+    else return false;
+    return true;
+}
+
+// Value at a percentile of an unsorted sample (reorders the sample)
+float Percentile(std::vector<float>& sample, float percent) {
+    if (sample.empty()) {
+        return 0;
+    }
+    size_t index = std::min(sample.size() - 1, (size_t)(percent / 100.0f * sample.size()));
+    std::nth_element(sample.begin(), sample.begin() + index, sample.end());
+    return sample[index];
+}
+
+// copied from main.cpp
+// Simulation phases timed by the profiler
+enum TickPhase {
+    PHASE_PLAYER,
+    PHASE_SHOOTING,
+    PHASE_PROJECTILES,
+    PHASE_ROOM,
+    PHASE_COUNT
+};
+
+// Number of ticks/frames kept for rolling statistics (two seconds at 60 FPS)
+const int PROFILER_WINDOW = 120;
+
+// Measures how long each phase of a tick takes and keeps rolling statistics
+// of tick and frame times
+struct TickProfiler {
+    std::chrono::steady_clock::time_point tickStart;
+    std::chrono::steady_clock::time_point lastMark;
+    float phaseMicros[PHASE_COUNT];
+    float tickMicros;
+    float tickHistory[PROFILER_WINDOW];
+    float frameHistory[PROFILER_WINDOW];
+    int tickCount;
+    int frameCount;
+    
+    // Constructor
+    TickProfiler() {
+        Reset();
+    }
+    
+    // Forget all measurements
+    void Reset() {
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            phaseMicros[i] = 0;
+        }
+        for (int i = 0; i < PROFILER_WINDOW; i++) {
+            tickHistory[i] = 0;
+            frameHistory[i] = 0;
+        }
+        tickMicros = 0;
+        tickCount = 0;
+        frameCount = 0;
+    }
+    
+    // Start timing a tick
+    void BeginTick() {
+        tickStart = std::chrono::steady_clock::now();
+        lastMark = tickStart;
+    }
+    
+    // Attribute the time since the previous mark to a phase
+    void Mark(TickPhase phase) {
+        auto now = std::chrono::steady_clock::now();
+        phaseMicros[phase] = std::chrono::duration<float, std::micro>(now - lastMark).count();
+        lastMark = now;
+    }
+    
+    // Finish timing a tick
+    void EndTick() {
+        tickMicros = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - tickStart).count();
+        tickHistory[tickCount % PROFILER_WINDOW] = tickMicros;
+        tickCount++;
+    }
+    
+    // Record the duration of a whole frame (simulation plus drawing)
+    void RecordFrame(float seconds) {
+        frameHistory[frameCount % PROFILER_WINDOW] = seconds;
+        frameCount++;
+    }
+    
+    // Average tick time over the rolling window
+    float AverageTickMicros() const {
+        return Average(tickHistory, tickCount);
+    }
+    
+    // Average frame time over the rolling window
+    float AverageFrameTime() const {
+        return Average(frameHistory, frameCount);
+    }
+    
+    // Worst frame time over the rolling window
+    float MaxFrameTime() const {
+        float worst = 0;
+        for (int i = 0; i < std::min(frameCount, PROFILER_WINDOW); i++) {
+            worst = std::max(worst, frameHistory[i]);
+        }
+        return worst;
+    }
+    
+    // Average of the filled part of a history buffer
+    static float Average(const float* history, int count) {
+        int filled = std::min(count, PROFILER_WINDOW);
+        if (filled == 0) {
+            return 0;
+        }
+        float sum = 0;
+        for (int i = 0; i < filled; i++) {
+            sum += history[i];
+        }
+        return sum / filled;
+    }
+};
+
+// copied from main.cpp
+// Upper bound on live particles
+const int MAX_PARTICLES = 512;
+
+// Frame time the game must stay within (60 FPS)
+const float FRAME_BUDGET = 1.0f / 60.0f;
+// Longest frame time fed into the simulation (avoids huge steps after stalls)
+const float MAX_FRAME_TIME = 0.1f;
+// Seconds between director decisions
+const float DIRECTOR_INTERVAL = 0.5f;
+// Number of load reduction steps the director can apply
+const int DIRECTOR_MAX_LOAD = 3;
+
+// Adjusts spawn rate, enemy fire rate and particle budget from two signals:
+// how well the player is doing (challenge) and how close frames are to the
+// budget (load). Both only change after several consistent evaluations, so
+// the settings do not oscillate. Frame times come from the per-tick delta
+// time, which replays record, so re-simulation stays deterministic.
+struct Director {
+    float challenge;
+    int loadLevel;
+    int overBudgetCount;
+    int withinBudgetCount;
+    int easyCount;
+    int hardCount;
+    int damageTaken;
+    float timer;
+    
+    // Outputs read by the game
+    float spawnRateScale;
+    float fireRateScale;
+    int enemyCap;
+    int particleBudget;
+    
+    // Constructor
+    Director() {
+        Reset();
+    }
+    
+    // Return to default settings
+    void Reset() {
+        challenge = 1.0f;
+        loadLevel = 0;
+        overBudgetCount = 0;
+        withinBudgetCount = 0;
+        easyCount = 0;
+        hardCount = 0;
+        damageTaken = 0;
+        timer = 0;
+        ApplySettings();
+    }
+    
+    // Record damage dealt to the player
+    void ReportDamage(int amount) {
+        damageTaken += amount;
+    }
+    
+    // Re-evaluate difficulty and load every DIRECTOR_INTERVAL seconds
+    void Update(float deltaTime, const TickProfiler& profiler, const Player& player) {
+        timer += deltaTime;
+        if (timer < DIRECTOR_INTERVAL) {
+            return;
+        }
+        timer -= DIRECTOR_INTERVAL;
+        
+        // Frame budget: shed load quickly when over, restore slowly when back within
+        float frameTime = profiler.AverageFrameTime();
+        if (frameTime > FRAME_BUDGET * 1.15f) {
+            overBudgetCount++;
+            withinBudgetCount = 0;
+        } else if (frameTime <= FRAME_BUDGET * 1.05f) {
+            withinBudgetCount++;
+            overBudgetCount = 0;
+        }
+        if (overBudgetCount >= 2 && loadLevel < DIRECTOR_MAX_LOAD) {
+            loadLevel++;
+            overBudgetCount = 0;
+        } else if (withinBudgetCount >= 8 && loadLevel > 0) {
+            loadLevel--;
+            withinBudgetCount = 0;
+        }
+        
+        // Player performance: harder when unhurt and healthy, easier when struggling
+        float healthFraction = (float)player.health / player.maxHealth;
+        if (damageTaken == 0 && healthFraction > 0.6f) {
+            easyCount++;
+            hardCount = 0;
+        } else if (damageTaken >= 15 || healthFraction < 0.3f) {
+            hardCount++;
+            easyCount = 0;
+        } else {
+            easyCount = 0;
+            hardCount = 0;
+        }
+        if (easyCount >= 6) {
+            challenge = std::min(1.5f, challenge + 0.1f);
+            easyCount = 0;
+        } else if (hardCount >= 2) {
+            challenge = std::max(0.6f, challenge - 0.15f);
+            hardCount = 0;
+        }
+        damageTaken = 0;
+        
+        ApplySettings();
+    }
+    
+    // Derive the game settings from challenge and load
+    void ApplySettings() {
+        float loadFactor = 1.0f - 0.2f * loadLevel;
+        spawnRateScale = challenge * loadFactor;
+        fireRateScale = challenge * loadFactor;
+        enemyCap = MAX_ROOM_ENEMIES >> loadLevel;
+        particleBudget = MAX_PARTICLES >> (2 * loadLevel);
+    }
+};
+
+// copied from main.cpp
+// Number of quality levels (0 = full detail)
+const int QUALITY_LEVELS = 4;
+
+// Degrades optional work when the rolling frame time exceeds the budget and
+// restores it when headroom returns. Like the director it uses separate
+// thresholds and streaks in each direction so it does not flip every frame.
+struct QualityManager {
+    int level;
+    int overBudgetCount;
+    int withinBudgetCount;
+    float timer;
+    
+    // Constructor
+    QualityManager() {
+        Reset();
+    }
+    
+    // Return to full quality
+    void Reset() {
+        level = 0;
+        overBudgetCount = 0;
+        withinBudgetCount = 0;
+        timer = 0;
+    }
+    
+    // Re-check the frame budget every 0.25 seconds
+    void Update(float deltaTime, const TickProfiler& profiler) {
+        timer += deltaTime;
+        if (timer < 0.25f) {
+            return;
+        }
+        timer -= 0.25f;
+        
+        float frameTime = profiler.AverageFrameTime();
+        if (frameTime > FRAME_BUDGET * 1.1f) {
+            overBudgetCount++;
+            withinBudgetCount = 0;
+        } else if (frameTime <= FRAME_BUDGET * 1.02f) {
+            withinBudgetCount++;
+            overBudgetCount = 0;
+        }
+        
+        // Degrade after 1 s over budget, restore after 3 s within it
+        if (overBudgetCount >= 4 && level < QUALITY_LEVELS - 1) {
+            level++;
+            overBudgetCount = 0;
+        } else if (withinBudgetCount >= 12 && level > 0) {
+            level--;
+            withinBudgetCount = 0;
+        }
+    }
+    
+    // Segments used to draw circles
+    int CircleSegments() const {
+        const int segments[QUALITY_LEVELS] = { 36, 24, 16, 10 };
+        return segments[level];
+    }
+    
+    // Whether damaged enemies far from the player still show health bars
+    bool OffFocusHealthBars() const {
+        return level == 0;
+    }
+    
+    // Distance beyond which enemy AI runs at a reduced rate
+    float AILodDistance() const {
+        const float distances[QUALITY_LEVELS] = { INFINITY, 600.0f, 400.0f, 250.0f };
+        return distances[level];
+    }
+    
+    // Particle budget after applying quality on top of the director's budget
+    int ParticleBudget(int directorBudget) const {
+        if (level == QUALITY_LEVELS - 1) {
+            return 0;
+        }
+        return std::min(directorBudget, MAX_PARTICLES >> level);
+    }
+};
+
+// copied from main.cpp
+class SceneManager;
+
+// Base class for every screen on the scene stack. Scenes are created once and
+// live for the whole program: a scene covered by another one is suspended,
+// not torn down, and only the top scene is updated each frame.
+class Scene {
+public:
+    SceneManager* manager;
+    
+    // Constructor
+    Scene() {
+        manager = nullptr;
+    }
+    
+    // Virtual destructor
+    virtual ~Scene() {}
+    
+    // Start loading in the background so a later switch is instant
+    virtual void StartPreload() {}
+    
+    // Check if the scene can be shown without waiting
+    virtual bool IsLoaded() const {
+        return true;
+    }
+    
+    // Called when the scene becomes the top of the stack
+    virtual void Enter() {}
+    
+    // Called when the scene is removed from the stack
+    virtual void Exit() {}
+    
+    // Called when another scene is pushed on top of this one
+    virtual void Suspend() {}
+    
+    // Called when the scene above this one is popped
+    virtual void Resume() {}
+    
+    // Per-frame logic (top scene only)
+    virtual void Update() = 0;
+    
+    // Draw the scene
+    virtual void Draw() = 0;
+    
+    // Static scenes only change in response to input
+    virtual bool IsStatic() const {
+        return true;
+    }
+    
+    // Overlays are drawn on top of the scene below them
+    virtual bool IsOverlay() const {
+        return false;
+    }
+};
+
+// Stack of active scenes with transitions that go through a loading scene
+// when the target is still preloading
+class SceneManager {
+private:
+    std::vector<Scene*> stack;
+    Scene* loadingScene;
+    Scene* pendingScene;
+    bool needsRedraw;
+    
+public:
+    // Constructor
+    SceneManager() {
+        loadingScene = nullptr;
+        pendingScene = nullptr;
+        needsRedraw = true;
+    }
+    
+    // Scene shown while waiting for a scene to finish preloading
+    void SetLoadingScene(Scene* scene) {
+        scene->manager = this;
+        loadingScene = scene;
+    }
+    
+    // Put a scene on top, suspending the current one
+    void Push(Scene* scene) {
+        if (!stack.empty()) {
+            stack.back()->Suspend();
+        }
+        scene->manager = this;
+        stack.push_back(scene);
+        scene->Enter();
+        needsRedraw = true;
+    }
+    
+    // Remove the top scene, resuming the one below
+    void Pop() {
+        if (stack.empty()) {
+            return;
+        }
+        stack.back()->Exit();
+        stack.pop_back();
+        if (!stack.empty()) {
+            stack.back()->Resume();
+        }
+        needsRedraw = true;
+    }
+    
+    // Replace the top scene
+    void Replace(Scene* scene) {
+        if (!stack.empty()) {
+            stack.back()->Exit();
+            stack.pop_back();
+        }
+        Push(scene);
+    }
+    
+    // Replace the top scene, showing the loading scene until the target is ready
+    void SwitchTo(Scene* scene) {
+        if (scene->IsLoaded() || !loadingScene) {
+            Replace(scene);
+            return;
+        }
+        pendingScene = scene;
+        Replace(loadingScene);
+    }
+    
+    // Called by the loading scene: switch to the pending scene once it is ready
+    void FinishLoading() {
+        if (pendingScene && pendingScene->IsLoaded()) {
+            Scene* scene = pendingScene;
+            pendingScene = nullptr;
+            Replace(scene);
+        }
+    }
+    
+    // Update the top scene
+    void Update() {
+        if (stack.empty()) {
+            return;
+        }
+        if (IsStatic() && GetKeyPressed() != 0) {
+            needsRedraw = true;
+        }
+        stack.back()->Update();
+    }
+    
+    // Draw the top scene and every scene visible below its overlays
+    void Draw() {
+        BeginDrawing();
+        ClearBackground(BLACK);
+        
+        int first = (int)stack.size() - 1;
+        while (first > 0 && stack[first]->IsOverlay()) {
+            first--;
+        }
+        for (int i = std::max(first, 0); i < (int)stack.size(); i++) {
+            stack[i]->Draw();
+        }
+        
+        EndDrawing();
+        needsRedraw = false;
+    }
+    
+    // Check if the top scene only changes in response to input
+    bool IsStatic() const {
+        return stack.empty() || stack.back()->IsStatic();
+    }
+    
+    // Check if the screen has to be drawn again
+    bool NeedsRedraw() const {
+        return needsRedraw || !IsStatic();
+    }
+    
+    // Force a redraw on the next frame
+    void RequestRedraw() {
+        needsRedraw = true;
+    }
+};
+
+// Scene that counts its transitions and frames, for the scene tests
+class RecordingScene : public Scene {
+public:
+    bool isStatic;
+    bool isOverlay;
+    bool loaded;
+    int preloads;
+    int enters;
+    int exits;
+    int suspends;
+    int resumes;
+    int updates;
+    int draws;
+    
+    // Constructor
+    RecordingScene(bool staticScene = true, bool overlay = false) {
+        isStatic = staticScene;
+        isOverlay = overlay;
+        loaded = true;
+        preloads = 0;
+        enters = 0;
+        exits = 0;
+        suspends = 0;
+        resumes = 0;
+        updates = 0;
+        draws = 0;
+    }
+    
+    // Count the calls made by the scene manager
+    void StartPreload() override {
+        preloads++;
+    }
+    
+    void Enter() override {
+        enters++;
+    }
+    
+    void Exit() override {
+        exits++;
+    }
+    
+    void Suspend() override {
+        suspends++;
+    }
+    
+    void Resume() override {
+        resumes++;
+    }
+    
+    void Update() override {
+        updates++;
+    }
+    
+    void Draw() override {
+        draws++;
+    }
+    
+    // Loading, static and overlay state are set by the test
+    bool IsLoaded() const override {
+        return loaded;
+    }
+    
+    bool IsStatic() const override {
+        return isStatic;
+    }
+    
+    bool IsOverlay() const override {
+        return isOverlay;
+    }
+};
+
+// Simple test framework
+void RunTests();
+void TestEntityCreation();
+void TestEntityCollision();
+void TestProjectile();
+void TestPlayer();
+void TestEnemy();
+void TestRoom();
+void TestEnemyPool();
+void TestEnemyGrid();
+void TestStatusEffects();
+void TestPickups();
+void TestBossPatterns();
+void TestSquads();
+void TestBoidSwarm();
+void TestTileGrid();
+void TestFogOfWar();
+void TestLightMap();
+void TestRoomCache();
+void TestRoomTemplate();
+void TestDungeonGrid();
+void TestReplay();
+void TestTelemetry();
+void TestDirector();
+void TestQualityManager();
+void TestIdleRedraw();
+void TestDungeonReset();
+void TestPregeneration();
+void TestSceneStack();
+
+int main() {
+    // Initialize window (needed for Raylib)
+    InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Test Window");
+    SetWindowState(FLAG_WINDOW_HIDDEN); // Hide the window for tests
+    
+    // Run tests
+    std::cout << "Running unit tests for Top-Down Shooter game..." << std::endl;
+    
+    RunTests();
+    
+    std::cout << "All tests passed!" << std::endl;
+    std::cout << "Press any key to exit..." << std::endl;
+    _getch(); // Wait for user to press a key before exiting
+    
+    // Close window
+    CloseWindow();
+    
+    return 0;
+}
+
+void RunTests() {
+    TestEntityCreation();
+    TestEntityCollision();
+    TestProjectile();
+    TestPlayer();
+    TestEnemy();
+    TestRoom();
+    TestEnemyPool();
+    TestEnemyGrid();
+    TestStatusEffects();
+    TestPickups();
+    TestBossPatterns();
+    TestSquads();
+    TestBoidSwarm();
+    TestTileGrid();
+    TestFogOfWar();
+    TestLightMap();
+    TestRoomCache();
+    TestRoomTemplate();
+    TestDungeonGrid();
+    TestReplay();
+    TestTelemetry();
+    TestDirector();
+    TestQualityManager();
+    TestIdleRedraw();
+    TestDungeonReset();
+    TestPregeneration();
+    TestSceneStack();
+}
+
+void TestEntityCreation() {
+    std::cout << "Testing Entity creation..." << std::endl;
+    
+    // Create an entity
+    Entity entity(100, 200, 15, 50, RED);
+    
+    // Verify its properties
+    assert(entity.x == 100);
+    assert(entity.y == 200);
+    assert(entity.radius == 15);
+    assert(entity.health == 50);
+    assert(entity.maxHealth == 50);
+    assert(entity.active == true);
+    assert(entity.color.r == RED.r && entity.color.g == RED.g && entity.color.b == RED.b);
+    assert(entity.facing == RIGHT);
+    
+    // Test taking damage
+    entity.TakeDamage(20);
+    assert(entity.health == 30);
+    
+    // Test entity deactivation when health reaches 0
+    entity.TakeDamage(30);
+    assert(entity.health == 0);
+    assert(entity.active == false);
+    
+    std::cout << "Entity creation test passed!" << std::endl;
+}
+
+void TestEntityCollision() {
+    std::cout << "Testing Entity collision..." << std::endl;
+    
+    // Create two entities
+    Entity entity1(100, 100, 15, 50, RED);
+    Entity entity2(120, 100, 15, 50, BLUE);
+    
+    // Test collision detection
+    assert(entity1.IsColliding(&entity2) == true);
+    
+    // Move entity2 far enough away to avoid collision
+    entity2.x = 200;
+    assert(entity1.IsColliding(&entity2) == false);
+    
+    std::cout << "Entity collision test passed!" << std::endl;
+}
+
+void TestProjectile() {
+    std::cout << "Testing Projectile functionality..." << std::endl;
+    
+    // Create a projectile pool
+    ProjectilePool projectiles;
+    
+    // Initially empty
+    assert(projectiles.count == 0);
+    
+    // Fire a pistol shot to the right
+    const WeaponDef& pistol = weaponDefs[WEAPON_PISTOL];
+    bool spawned = projectiles.Spawn(100, 100, DIRECTION_X[RIGHT] * pistol.speed, DIRECTION_Y[RIGHT] * pistol.speed, WEAPON_PISTOL, false);
+    assert(spawned);
+    
+    // Verify projectile state
+    assert(projectiles.count == 1);
+    assert(projectiles.x[0] == 100);
+    assert(projectiles.y[0] == 100);
+    assert(projectiles.speedX[0] == PROJECTILE_SPEED);
+    assert(projectiles.speedY[0] == 0);
+    assert(projectiles.fromEnemy[0] == false);
+    assert(projectiles.damage[0] == 10);
+    
+    // Test movement
+    float deltaTime = 0.5f;
+    projectiles.Integrate(deltaTime, 0, 0, 1000, 1000);
+    assert(projectiles.x[0] == 100 + PROJECTILE_SPEED * deltaTime);
+    assert(projectiles.y[0] == 100);
+    
+    // Test enemy projectile
+    const WeaponDef& blaster = weaponDefs[WEAPON_ENEMY_BLASTER];
+    projectiles.Spawn(200, 200, DIRECTION_X[DOWN] * blaster.speed, DIRECTION_Y[DOWN] * blaster.speed, WEAPON_ENEMY_BLASTER, true);
+    assert(projectiles.fromEnemy[1] == true);
+    assert(projectiles.damage[1] == 5);
+    assert(projectiles.speedY[1] == PROJECTILE_SPEED);
+    
+    // Removing a projectile moves the last one into its slot
+    projectiles.Remove(0);
+    assert(projectiles.count == 1);
+    assert(projectiles.fromEnemy[0] == true);
+    assert(projectiles.x[0] == 200);
+    
+    // The pool refuses new projectiles when full
+    projectiles.Clear();
+    for (int i = 0; i < MAX_PROJECTILES; i++) {
+        spawned = projectiles.Spawn(0, 0, 0, 0, WEAPON_PISTOL, false);
+        assert(spawned);
+    }
+    spawned = projectiles.Spawn(0, 0, 0, 0, WEAPON_PISTOL, false);
+    assert(!spawned);
+    
+    // A bouncing projectile is reflected back inside the walls once
+    projectiles.Clear();
+    projectiles.Spawn(90, 50, 100, 0, WEAPON_PISTOL, false);
+    projectiles.bounces[0] = 1;
+    projectiles.Integrate(0.2f, 0, 0, 100, 100);
+    assert(projectiles.x[0] == 90);
+    assert(projectiles.speedX[0] == -100);
+    assert(projectiles.bounces[0] == 0);
+    projectiles.Integrate(1.0f, 0, 0, 100, 100);
+    assert(projectiles.x[0] < 0); // Out of bounces, left outside for removal
+    
+    // A rifle shot takes its pierce from the weapon table and hits each
+    // enemy once until its pierce runs out
+    projectiles.Clear();
+    projectiles.Spawn(0, 0, 0, 0, WEAPON_RIFLE, false);
+    assert(projectiles.pierce[0] == weaponDefs[WEAPON_RIFLE].pierce);
+    assert(projectiles.pierce[0] == 2);
+    assert(!projectiles.HasHit(0, 3, 0));
+    bool pierced = projectiles.RecordHit(0, 3, 0);
+    assert(pierced);
+    assert(projectiles.HasHit(0, 3, 0));
+    
+    // A new enemy respawned into a slot that was hit is a new target
+    assert(!projectiles.HasHit(0, 3, 1));
+    pierced = projectiles.RecordHit(0, 3, 1);
+    assert(pierced);
+    pierced = projectiles.RecordHit(0, 7, 0);
+    assert(!pierced);
+    
+    std::cout << "Projectile test passed!" << std::endl;
+}
+
+void TestPlayer() {
+    std::cout << "Testing Player functionality..." << std::endl;
+    
+    // Create a player
+    Player player(100, 100);
+    
+    // Verify initial state
+    assert(player.x == 100);
+    assert(player.y == 100);
+    assert(player.health == PLAYER_HEALTH);
+    assert(player.radius == 15);
+    assert(player.color.r == BLUE.r && player.color.g == BLUE.g && player.color.b == BLUE.b);
+    
+    // Test shooting cooldown
+    assert(player.CanShoot() == true);
+    player.ResetShootCooldown();
+    assert(player.CanShoot() == false);
+    
+    std::cout << "Player test passed!" << std::endl;
+}
+
+void TestEnemy() {
+    std::cout << "Testing Enemy functionality..." << std::endl;
+    
+    // Create RNG
+    std::mt19937 rng(42); // Fixed seed for reproducibility
+    
+    // Create an enemy
+    Enemy enemy(200, 200, &rng);
+    
+    // Verify initial state
+    assert(enemy.x == 200);
+    assert(enemy.y == 200);
+    assert(enemy.health == ENEMY_HEALTH);
+    assert(enemy.radius == 12);
+    assert(enemy.color.r == RED.r && enemy.color.g == RED.g && enemy.color.b == RED.b);
+    
+    // The issue is here - we're assuming enemy.aggro is false initially,
+    // but we should make sure of that
+    assert(enemy.aggro == false); // This should be guaranteed by the constructor
+    
+    // Create a player far away (300 units is > 150 aggro range)
+    Player player(500, 500); 
+    
+    // Update enemy (player not in aggro range)
+    enemy.Update(0.1f, &player);
+    assert(enemy.aggro == false);
+    
+    // Move player closer to trigger aggro (within 150 units)
+    player.x = 220;
+    player.y = 220;
+    enemy.Update(0.1f, &player);
+    assert(enemy.aggro == true);
+    
+    // Test shooting cooldown
+    assert(enemy.CanShoot() == true); // Can shoot when aggro and cooldown 0
+    enemy.ResetShootCooldown();
+    assert(enemy.CanShoot() == false); // Cannot shoot when cooldown > 0
+    
+    // Test boss creation
+    Boss boss(400, 400, &rng);
+    assert(boss.health == BOSS_HEALTH);
+    assert(boss.radius == 25);
+    assert(boss.color.r == PURPLE.r && boss.color.g == PURPLE.g && boss.color.b == PURPLE.b);
+    
+    std::cout << "Enemy test passed!" << std::endl;
+}
+
+void TestRoom() {
+    std::cout << "Testing Room functionality..." << std::endl;
+    
+    // Create RNG
+    std::mt19937 rng(42);
+    
+    // Create a room
+    Room room(0, 0, std::make_shared<const RoomTemplate>(800.0f, 600.0f));
+    
+    // Verify initial state
+    assert(room.x == 0);
+    assert(room.y == 0);
+    assert(room.width == 800);
+    assert(room.height == 600);
+    assert(room.cleared == false);
+    assert(room.layout->hasBoss == false);
+    
+    // Test adding enemies
+    room.AddEnemy(100, 100, &rng);
+    room.AddEnemy(200, 200, &rng);
+    assert(room.enemies.size() == 2);
+    
+    // Test point containment
+    assert(room.ContainsPoint(100, 100) == true);
+    assert(room.ContainsPoint(900, 100) == false);
+    
+    // Test room clearing
+    for (auto& enemy : room.enemies) {
+        enemy->active = false;
+    }
+    
+    // Create a player for room update
+    Player player(400, 300);
+    
+    // Update room
+    room.Update(0.1f, &player);
+    
+    // Room should be cleared now
+    assert(room.cleared == true);
+    
+    std::cout << "Room test passed!" << std::endl;
+}
+
+void TestEnemyPool() {
+    std::cout << "Testing EnemyPool and waves..." << std::endl;
+    
+    std::mt19937 rng(42);
+    EnemyPool pool;
+    SquadPool squadPool;
+    pool.Preallocate(ENEMY_POOL_SIZE, &rng);
+    assert(pool.available.size() == ENEMY_POOL_SIZE);
+    
+    // Spawning takes enemies from the pool
+    Room room(0, 0, std::make_shared<const RoomTemplate>(800.0f, 600.0f));
+    Enemy* first = room.SpawnEnemy(100, 100, pool);
+    assert(first != nullptr && first->active);
+    assert(room.enemies.size() == 1);
+    assert(pool.available.size() == ENEMY_POOL_SIZE - 1);
+    
+    // A dead enemy is reused in place instead of growing the room
+    first->TakeDamage(ENEMY_HEALTH);
+    first->lootDropped = true;
+    first->squad = 2;
+    first->speedX = 0;
+    first->speedY = 0;
+    assert(first->active == false);
+    Enemy* second = room.SpawnEnemy(200, 200, pool);
+    assert(second == first);
+    assert(second->active && second->health == ENEMY_HEALTH && second->x == 200);
+    
+    // Respawning clears what the enemy's previous life left behind and
+    // sends it off in a new direction
+    assert(!second->lootDropped && second->squad == -1 && second->canSee);
+    assert(second->generation == 2);
+    assert(second->speedX != 0 || second->speedY != 0);
+    assert(room.enemies.size() == 1);
+    
+    // A fast wave spawns several enemies in one tick, and the room is not
+    // cleared until the wave has finished
+    room.AddWave(1.0f, 10, 0.25f);
+    Player player(400, 300);
+    room.UpdateWaves(0.5f, pool, squadPool, rng);
+    assert(room.enemies.size() == 1);
+    room.UpdateWaves(1.0f, pool, squadPool, rng);
+    assert(room.enemies.size() == 4);
+    for (auto& enemy : room.enemies) {
+        enemy->active = false;
+    }
+    room.Update(0.0f, &player);
+    assert(room.cleared == false);
+    
+    // The rest of the wave reuses the four dead slots first
+    room.UpdateWaves(5.0f, pool, squadPool, rng);
+    assert(room.WavesFinished());
+    assert(room.enemies.size() == 7);
+    
+    // Rooms never grow past their cap, even under continuous spawning
+    for (int i = 0; i < 1000; i++) {
+        room.SpawnEnemy(300, 300, pool);
+    }
+    assert(room.enemies.size() == MAX_ROOM_ENEMIES);
+    
+    // Releasing returns every enemy, bosses included, and keeps the room's storage
+    room.AddBoss(400, 300, &rng);
+    room.ReleaseEnemies(pool, squadPool);
+    assert(room.enemies.empty());
+    assert(room.enemies.capacity() >= MAX_ROOM_ENEMIES);
+    assert(pool.available.size() == ENEMY_POOL_SIZE);
+    assert(pool.bosses.size() == 1);
+    
+    // Topping the pool up only allocates what is missing, counting the
+    // enemies lent to rooms
+    Enemy* lent = room.SpawnEnemy(100, 100, pool);
+    pool.Preallocate(ENEMY_POOL_SIZE, &rng);
+    assert(pool.allocated == ENEMY_POOL_SIZE);
+    assert(pool.available.size() == ENEMY_POOL_SIZE - 1);
+    pool.Preallocate(ENEMY_POOL_SIZE + 2, &rng);
+    assert(pool.allocated == ENEMY_POOL_SIZE + 2);
+    assert(pool.available.size() == ENEMY_POOL_SIZE + 1);
+    assert(lent->active);
+    
+    // A released boss is handed out again at full health
+    Enemy* boss = pool.bosses.back().get();
+    room.SpawnBoss(500, 300, pool, &rng);
+    assert(room.enemies.back().get() == boss);
+    assert(pool.bosses.empty());
+    assert(boss->IsBoss() && boss->active && boss->health == BOSS_HEALTH && boss->x == 500);
+    room.ReleaseEnemies(pool, squadPool);
+    assert(pool.bosses.size() == 1);
+    assert(pool.available.size() == ENEMY_POOL_SIZE + 2);
+    
+    std::cout << "EnemyPool test passed!" << std::endl;
+}
+
+void TestEnemyGrid() {
+    std::cout << "Testing EnemyGrid functionality..." << std::endl;
+    
+    // Scatter enemies over a room, with a few dead ones
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> xDist(100, 900);
+    std::uniform_real_distribution<float> yDist(50, 650);
+    Room room(100, 50, std::make_shared<const RoomTemplate>(800.0f, 600.0f));
+    for (int i = 0; i < 100; i++) {
+        room.enemies.push_back(std::make_unique<Enemy>(xDist(rng), yDist(rng), &rng));
+        room.enemies.back()->active = i % 10 != 0;
+    }
+    
+    EnemyGrid grid;
+    grid.Build(room);
+    assert((int)grid.enemyIndex.size() == 90);
+    
+    // Nearest queries match a brute force scan
+    float queryX[50];
+    float queryY[50];
+    int result[50];
+    for (int q = 0; q < 50; q++) {
+        queryX[q] = xDist(rng);
+        queryY[q] = yDist(rng);
+    }
+    grid.NearestBatch(queryX, queryY, 50, 10000.0f, result);
+    for (int q = 0; q < 50; q++) {
+        int expected = -1;
+        float expectedDistance = 1e30f;
+        for (int e = 0; e < (int)room.enemies.size(); e++) {
+            if (!room.enemies[e]->active) {
+                continue;
+            }
+            float dx = room.enemies[e]->x - queryX[q];
+            float dy = room.enemies[e]->y - queryY[q];
+            if (dx*dx + dy*dy < expectedDistance) {
+                expectedDistance = dx*dx + dy*dy;
+                expected = e;
+            }
+        }
+        assert(result[q] == expected);
+    }
+    
+    // Nothing is returned beyond the search radius
+    assert(grid.Nearest(-5000, -5000, 100.0f) == -1);
+    
+    // Ray casts find the same nearest hits as testing every enemy
+    for (int r = 0; r < 50; r++) {
+        float angle = r * 0.37f;
+        float dirX = cos(angle);
+        float dirY = sin(angle);
+        float originX = xDist(rng);
+        float originY = yDist(rng);
+        int hits[3];
+        float hitT[3];
+        int hitCount = grid.CastRay(originX, originY, dirX, dirY, 500.0f, 3, hits, hitT);
+        
+        int expected[3];
+        float expectedT[3];
+        int expectedCount = 0;
+        for (int e = 0; e < (int)room.enemies.size(); e++) {
+            const Enemy* enemy = room.enemies[e].get();
+            float t = RayCircleHit(originX, originY, dirX, dirY, enemy->x, enemy->y, enemy->radius);
+            if (enemy->active && t <= 500.0f) {
+                EnemyGrid::InsertHit(e, t, 3, expected, expectedT, expectedCount);
+            }
+        }
+        assert(hitCount == expectedCount);
+        for (int h = 0; h < hitCount; h++) {
+            assert(hits[h] == expected[h]);
+        }
+    }
+    
+    // Radius queries find exactly the enemies overlapping the circle
+    std::vector<int> inBlast;
+    for (int q = 0; q < 20; q++) {
+        float blastX = xDist(rng);
+        float blastY = yDist(rng);
+        grid.QueryRadius(blastX, blastY, 120.0f, inBlast);
+        int expectedCount = 0;
+        for (int e = 0; e < (int)room.enemies.size(); e++) {
+            const Enemy* enemy = room.enemies[e].get();
+            float dx = enemy->x - blastX;
+            float dy = enemy->y - blastY;
+            float limit = 120.0f + enemy->radius;
+            if (enemy->active && dx*dx + dy*dy < limit * limit) {
+                expectedCount++;
+                assert(std::find(inBlast.begin(), inBlast.end(), e) != inBlast.end());
+            }
+        }
+        assert((int)inBlast.size() == expectedCount);
+    }
+    
+    // Removed enemies no longer block rays
+    int hit;
+    float hitT;
+    const Enemy* target = room.enemies[1].get();
+    int hitCount = grid.CastRay(target->x - 200, target->y, 1, 0, 400.0f, 1, &hit, &hitT);
+    assert(hitCount == 1);
+    grid.Remove(hit);
+    int next;
+    float nextT;
+    hitCount = grid.CastRay(target->x - 200, target->y, 1, 0, 400.0f, 1, &next, &nextT);
+    assert(hitCount == 0 || next != hit);
+    
+    std::cout << "EnemyGrid test passed!" << std::endl;
+}
+
+void TestStatusEffects() {
+    std::cout << "Testing StatusEffects functionality..." << std::endl;
+    
+    StatusEffects effects;
+    Entity target(0, 0, 10, 100, RED);
+    
+    // Burning deals its damage per second spread over the ticks
+    bool applied = effects.Apply(&target, STATUS_BURN, 10.0f, 1.0f);
+    assert(applied);
+    assert(target.statusIds[STATUS_BURN] >= 0);
+    for (int i = 0; i < 5; i++) {
+        effects.Update(0.1f);
+    }
+    assert(target.health == 95);
+    
+    // Slow and vulnerability change the modifiers while they last
+    effects.Apply(&target, STATUS_SLOW, 0.5f, 0.3f);
+    effects.Apply(&target, STATUS_VULNERABLE, 0.5f, 2.0f);
+    effects.Update(0.05f);
+    assert(target.speedScale == 0.5f);
+    assert(target.damageScale == 1.5f);
+    
+    // Expired effects are removed by the timer wheel and their modifiers reset
+    for (int i = 0; i < 10; i++) {
+        effects.Update(0.1f);
+    }
+    assert(target.statusIds[STATUS_BURN] == -1);
+    assert(target.statusIds[STATUS_SLOW] == -1);
+    assert(target.speedScale == 1.0f);
+    assert(target.statusIds[STATUS_VULNERABLE] >= 0);
+    
+    // Reapplying refreshes instead of adding a second effect
+    int countBefore = effects.count;
+    effects.Apply(&target, STATUS_VULNERABLE, 0.5f, 10.0f);
+    assert(effects.count == countBefore);
+    for (int i = 0; i < 50; i++) {
+        effects.Update(0.1f);
+    }
+    assert(target.statusIds[STATUS_VULNERABLE] >= 0); // Still running past the original 2 s
+    
+    // Stunned entities cannot move
+    effects.Apply(&target, STATUS_STUN, 1.0f, 0.5f);
+    effects.Update(0.01f);
+    assert(target.stunned && target.speedScale == 0);
+    
+    // Effects on dead entities are dropped
+    target.TakeDamage(1000);
+    effects.Update(0.01f);
+    assert(effects.count == 0);
+    
+    // An enemy burned to death loses all its effects in the same update, so
+    // a wave that respawns it into the same slot right after gets a clean enemy
+    Room room(0, 0, std::make_shared<const RoomTemplate>(800.0f, 600.0f));
+    EnemyPool pool;
+    SquadPool squadPool;
+    std::mt19937 rng(1);
+    pool.Preallocate(4, &rng);
+    Enemy* victim = room.SpawnEnemy(100, 100, pool);
+    assert(victim != nullptr);
+    victim->health = 1;
+    applied = effects.Apply(victim, STATUS_SLOW, 0.5f, 5.0f);
+    assert(applied);
+    applied = effects.Apply(victim, STATUS_VULNERABLE, 0.5f, 5.0f);
+    assert(applied);
+    applied = effects.Apply(victim, STATUS_BURN, 100.0f, 5.0f);
+    assert(applied);
+    effects.Update(0.1f);
+    assert(!victim->active);
+    assert(effects.count == 0);
+    Enemy* respawned = room.SpawnEnemy(200, 200, pool);
+    assert(respawned == victim);
+    for (int t = 0; t < STATUS_COUNT; t++) {
+        assert(respawned->statusIds[t] == -1);
+    }
+    effects.Update(0.1f);
+    assert(respawned->active && respawned->health == respawned->maxHealth);
+    assert(respawned->speedScale == 1.0f && respawned->damageScale == 1.0f);
+    room.ReleaseEnemies(pool, squadPool);
+    
+    // Many affected entities are ticked and expired together
+    std::vector<Entity> crowd(10000, Entity(0, 0, 10, 1000, RED));
+    for (auto& entity : crowd) {
+        applied = effects.Apply(&entity, STATUS_BURN, 10.0f, 1.0f);
+        assert(applied);
+        applied = effects.Apply(&entity, STATUS_SLOW, 0.5f, 2.0f);
+        assert(applied);
+    }
+    for (int i = 0; i < 12; i++) {
+        effects.Update(0.1f);
+    }
+    assert(effects.count == 10000);
+    assert(crowd[0].health == 990);
+    for (int i = 0; i < 10; i++) {
+        effects.Update(0.1f);
+    }
+    assert(effects.count == 0);
+    assert(crowd[9999].speedScale == 1.0f);
+    
+    std::cout << "StatusEffects test passed!" << std::endl;
+}
+
+void TestPickups() {
+    std::cout << "Testing Pickups functionality..." << std::endl;
+    
+    Room room(0, 0, std::make_shared<const RoomTemplate>(640.0f, 480.0f));
+    PickupPool pickups;
+    pickups.Reset(room);
+    unsigned char collected[16];
+    
+    // Pickups are only collected within reach
+    bool dropped = pickups.Drop(100, 100, PICKUP_HEALTH);
+    assert(dropped);
+    dropped = pickups.Drop(300, 300, PICKUP_POWER);
+    assert(dropped);
+    assert(pickups.count == 2);
+    int collectedCount = pickups.Collect(200, 200, 10, collected, 16);
+    assert(collectedCount == 0);
+    collectedCount = pickups.Collect(105, 100, 10, collected, 16);
+    assert(collectedCount == 1);
+    assert(collected[0] == PICKUP_HEALTH);
+    assert(pickups.count == 1);
+    
+    // Collected pickups are gone and their slots are reused
+    collectedCount = pickups.Collect(105, 100, 10, collected, 16);
+    assert(collectedCount == 0);
+    dropped = pickups.Drop(60, 60, PICKUP_HEALTH);
+    assert(dropped);
+    assert(pickups.highWater == 2);
+    
+    // Pickups across a cell border are found from either side
+    pickups.Reset(room);
+    pickups.Drop(GRID_CELL_SIZE - 2, 50, PICKUP_HEALTH);
+    pickups.Drop(GRID_CELL_SIZE + 2, 50, PICKUP_POWER);
+    collectedCount = pickups.Collect(GRID_CELL_SIZE, 50, 5, collected, 16);
+    assert(collectedCount == 2);
+    assert(pickups.count == 0);
+    
+    // A full pool refuses drops
+    for (int i = 0; i < MAX_PICKUPS; i++) {
+        dropped = pickups.Drop((float)(i % 640), (float)(i % 480), PICKUP_HEALTH);
+        assert(dropped);
+    }
+    dropped = pickups.Drop(10, 10, PICKUP_HEALTH);
+    assert(!dropped);
+    
+    std::cout << "Pickups test passed!" << std::endl;
+}
+
+void TestBossPatterns() {
+    std::cout << "Testing BossPatterns functionality..." << std::endl;
+    BuildBossPatterns();
+    float speed = weaponDefs[WEAPON_BOSS_ORB].speed;
+    
+    // A ring volley fans out evenly at full speed
+    const BossPattern& ring = bossPatterns[PATTERN_RING];
+    assert(ring.volleyCount == 2 && ring.shotsPerVolley == 24);
+    float sumX = 0;
+    float sumY = 0;
+    for (int k = 0; k < ring.shotsPerVolley; k++) {
+        sumX += ring.speedX[k];
+        sumY += ring.speedY[k];
+        assert(fabs(sqrt(ring.speedX[k] * ring.speedX[k] + ring.speedY[k] * ring.speedY[k]) - speed) < 0.01f);
+    }
+    assert(fabs(sumX) < 0.1f && fabs(sumY) < 0.1f);
+    
+    // Spiral volleys turn a little further each time
+    const BossPattern& spiral = bossPatterns[PATTERN_SPIRAL];
+    float first = atan2(spiral.speedY[0], spiral.speedX[0]);
+    float second = atan2(spiral.speedY[spiral.shotsPerVolley], spiral.speedX[spiral.shotsPerVolley]);
+    assert(fabs(second - first - 10.0f * DEG2RAD) < 0.001f);
+    
+    // The outer flower ring is slower than the inner one
+    const BossPattern& flower = bossPatterns[PATTERN_FLOWER];
+    assert(flower.shotsPerVolley == 48);
+    assert(fabs(flower.speedX[24]) + fabs(flower.speedY[24]) < fabs(flower.speedX[0]) + fabs(flower.speedY[0]) + 0.01f);
+    
+    // Firing a volley copies it into the projectile pool
+    ProjectilePool pool;
+    pool.Clear();
+    int spawned = pool.SpawnBatch(100, 100, ring.offsetX, ring.offsetY, ring.speedX, ring.speedY, ring.shotsPerVolley, WEAPON_BOSS_ORB, true);
+    assert(spawned == 24);
+    assert(pool.count == 24);
+    assert(pool.x[0] == 100 + ring.offsetX[0] && pool.speedY[5] == ring.speedY[5]);
+    assert(pool.fromEnemy[23] && pool.damage[23] == weaponDefs[WEAPON_BOSS_ORB].damage);
+    
+    // Only what fits is spawned when the pool fills up
+    pool.count = MAX_PROJECTILES - 10;
+    spawned = pool.SpawnBatch(0, 0, ring.offsetX, ring.offsetY, ring.speedX, ring.speedY, ring.shotsPerVolley, WEAPON_BOSS_ORB, true);
+    assert(spawned == 10);
+    assert(pool.count == MAX_PROJECTILES);
+    
+    std::cout << "BossPatterns test passed!" << std::endl;
+}
+
+void TestSquads() {
+    std::cout << "Testing Squads functionality..." << std::endl;
+    
+    std::mt19937 rng(42);
+    std::vector<Enemy> enemies(20, Enemy(0, 0, &rng));
+    Squads squads;
+    
+    // Members take the formation's slots in order
+    int wedge = squads.Create(400, 100, FORMATION_WEDGE);
+    assert(wedge == 0);
+    for (int i = 0; i < 3; i++) {
+        assert(squads.HasSlot(wedge));
+        squads.AddMember(wedge, &enemies[i]);
+    }
+    assert(squads.memberCount == 3);
+    assert(squads.targetX[0] == 400 && squads.targetY[0] == 100);
+    assert(squads.targetX[1] == 400 + SQUAD_SPACING && squads.targetY[1] == 100 + SQUAD_SPACING);
+    assert(squads.targetX[2] == 400 - SQUAD_SPACING && squads.targetY[2] == 100 + SQUAD_SPACING);
+    
+    // A squad is full after MAX_SQUAD_SIZE members
+    int line = squads.Create(100, 300, FORMATION_LINE);
+    for (int i = 3; i < 3 + MAX_SQUAD_SIZE; i++) {
+        squads.AddMember(line, &enemies[i]);
+    }
+    assert(!squads.HasSlot(line));
+    
+    // Leaders head for the player and members keep their offsets
+    squads.Update(0.5f, 400, 500, 0, 0, 800, 600);
+    assert(squads.leaderY[wedge] > 100);
+    for (int m = 0; m < squads.memberCount; m++) {
+        int s = squads.memberSquad[m];
+        assert(fabs(squads.targetX[m] - squads.leaderX[s] - squads.memberSlotX[m]) < 0.001f);
+        assert(fabs(squads.targetY[m] - squads.leaderY[s] - squads.memberSlotY[m]) < 0.001f);
+    }
+    
+    // Leaders stop once they are close to the player
+    float leaderY = squads.leaderY[wedge];
+    squads.Update(0.5f, 400, leaderY + 50, 0, 0, 800, 600);
+    squads.Update(0.5f, 400, leaderY + 50, 0, 0, 800, 600);
+    assert(squads.leaderSpeedX[wedge] == 0 && squads.leaderSpeedY[wedge] == 0);
+    
+    // Removing a member keeps the rest packed
+    Enemy* last = squads.memberEnemy[squads.memberCount - 1];
+    squads.RemoveMember(0);
+    assert(squads.memberCount == 2 + MAX_SQUAD_SIZE);
+    assert(squads.memberEnemy[0] == last);
+    
+    // Squad ids run out at MAX_SQUADS until cleared
+    while (squads.squadCount < MAX_SQUADS) {
+        squads.Create(0, 0, FORMATION_BOX);
+    }
+    int squad = squads.Create(0, 0, FORMATION_BOX);
+    assert(squad == -1);
+    squads.Clear();
+    squad = squads.Create(0, 0, FORMATION_BOX);
+    assert(squad == 0);
+    
+    // The pool lends out empty squad sets until it runs dry, and takes
+    // them back for the next room
+    SquadPool pool;
+    pool.Preallocate(SQUAD_POOL_SIZE);
+    pool.Preallocate(SQUAD_POOL_SIZE);
+    assert(pool.allocated == SQUAD_POOL_SIZE);
+    std::unique_ptr<Squads> lent = pool.Acquire();
+    assert(lent && lent->squadCount == 0);
+    lent->Create(0, 0, FORMATION_LINE);
+    Squads* lentSquads = lent.get();
+    pool.Release(std::move(lent));
+    pool.Release(nullptr);
+    assert((int)pool.available.size() == SQUAD_POOL_SIZE);
+    std::unique_ptr<Squads> again = pool.Acquire();
+    assert(again.get() == lentSquads && again->squadCount == 0);
+    std::unique_ptr<Squads> other = pool.Acquire();
+    assert(other && !pool.Acquire());
+    
+    std::cout << "Squads test passed!" << std::endl;
+}
 
-void TestProjectile() {
-    std::cout << "Testing Projectile functionality..." << std::endl;
+void TestBoidSwarm() {
+    std::cout << "Testing BoidSwarm functionality..." << std::endl;
     
-    // Create a projectile
-    Projectile projectile;
+    BoidSwarm swarm;
+    swarm.Reserve(64);
+    swarm.Reset(0, 0, 640, 480);
     
-    // Initially inactive
-    assert(projectile.active == false);
+    // Spawning stops at the reserved size
+    for (int i = 0; i < 64; i++) {
+        bool spawned = swarm.Spawn(100 + (i % 8) * 10.0f, 100 + (i / 8) * 10.0f, 0, 0);
+        assert(spawned);
+    }
+    bool spawned = swarm.Spawn(0, 0, 0, 0);
+    assert(!spawned);
     
-    // Fire projectile
-    projectile.Fire(100, 100, RIGHT, false);
+    // The grid sorts boids by cell and every boid stays in the swarm
+    swarm.Update(1.0f / 60, 600, 400);
+    assert(swarm.count == 64 && swarm.aliveCount == 64);
+    int total = 0;
+    for (int c = 0; c < swarm.cellsX * swarm.cellsY; c++) {
+        assert(swarm.cellStart[c] <= swarm.cellStart[c + 1]);
+        total += swarm.cellStart[c + 1] - swarm.cellStart[c];
+    }
+    assert(total == 64);
     
-    // Verify projectile state
-    assert(projectile.active == true);
-    assert(projectile.x == 100);
-    assert(projectile.y == 100);
-    assert(projectile.speedX == PROJECTILE_SPEED);
-    assert(projectile.speedY == 0);
-    assert(projectile.isEnemyProjectile == false);
-    assert(projectile.damage == 10);
+    // Boids head for the target and crowded boids push apart
+    float startX = 0;
+    for (int k = 0; k < swarm.count; k++) {
+        startX += swarm.x[k];
+    }
+    for (int t = 0; t < 60; t++) {
+        swarm.Update(1.0f / 60, 600, 400);
+    }
+    float endX = 0;
+    float closest = INFINITY;
+    for (int k = 0; k < swarm.count; k++) {
+        endX += swarm.x[k];
+        assert(swarm.x[k] >= 0 && swarm.x[k] <= 640 && swarm.y[k] >= 0 && swarm.y[k] <= 480);
+        assert(sqrt(swarm.speedX[k] * swarm.speedX[k] + swarm.speedY[k] * swarm.speedY[k]) <= BOID_MAX_SPEED + 0.01f);
+        for (int j = 0; j < k; j++) {
+            float dx = swarm.x[k] - swarm.x[j];
+            float dy = swarm.y[k] - swarm.y[j];
+            closest = std::min(closest, dx*dx + dy*dy);
+        }
+    }
+    assert(endX > startX);
+    assert(closest > 1.0f);
     
-    // Test movement
-    float deltaTime = 0.5f;
-    projectile.Update(deltaTime);
-    assert(projectile.x == 100 + PROJECTILE_SPEED * deltaTime);
-    assert(projectile.y == 100);
+    // Hits find live boids; killed boids are dropped on the next update
+    int boid = swarm.FindHit(swarm.x[0], swarm.y[0], 5);
+    assert(boid >= 0);
+    swarm.Kill(boid);
+    assert(swarm.aliveCount == 63);
+    int killed = swarm.KillInRadius(swarm.x[1], swarm.y[1], 20);
+    assert(killed >= 1);
+    swarm.Update(1.0f / 60, 600, 400);
+    assert(swarm.count == 63 - killed);
     
-    // Test enemy projectile
-    Projectile enemyProjectile;
-    enemyProjectile.Fire(200, 200, DOWN, true);
-    assert(enemyProjectile.isEnemyProjectile == true);
-    assert(enemyProjectile.damage == 5);
-    assert(enemyProjectile.speedY == PROJECTILE_SPEED);
+    // Splitting the steering across threads gives the same result
+    BoidSwarm single;
+    BoidSwarm threaded;
+    single.Reserve(4096);
+    threaded.Reserve(4096);
+    single.Reset(0, 0, 1600, 1600);
+    threaded.Reset(0, 0, 1600, 1600);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> posDist(0, 1600);
+    for (int i = 0; i < 4096; i++) {
+        float bx = posDist(rng);
+        float by = posDist(rng);
+        single.Spawn(bx, by, 0, 0);
+        threaded.Spawn(bx, by, 0, 0);
+    }
+    WorkerPool workers;
+    workers.Start(4);
+    assert(workers.ThreadCount() == 4);
+    for (int t = 0; t < 10; t++) {
+        single.Update(1.0f / 60, 800, 800);
+        threaded.Update(1.0f / 60, 800, 800, &workers);
+    }
+    for (int k = 0; k < single.count; k++) {
+        assert(single.x[k] == threaded.x[k] && single.y[k] == threaded.y[k]);
+    }
     
-    std::cout << "Projectile test passed!" << std::endl;
+    // The pool's threads are reused from job to job and every item is run once
+    std::vector<int> runs(1000, 0);
+    for (int job = 0; job < 100; job++) {
+        workers.Run((int)runs.size(), [&runs](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                runs[i]++;
+            }
+        });
+    }
+    assert(std::count(runs.begin(), runs.end(), 100) == (int)runs.size());
+    assert(workers.threads.size() == 3);
+    workers.Stop();
+    assert(workers.threads.empty());
+    
+    std::cout << "BoidSwarm test passed!" << std::endl;
 }
 
-void TestPlayer() {
-    std::cout << "Testing Player functionality..." << std::endl;
+void TestTileGrid() {
+    std::cout << "Testing TileGrid functionality..." << std::endl;
     
-    // Create a player
-    Player player(100, 100);
+    // A 10x8 grid with a 2x2 pillar at tiles (4,3)-(5,4)
+    TileGrid grid;
+    grid.Reset(100, 50, 400, 320);
+    assert(grid.tilesX == 10 && grid.tilesY == 8);
+    grid.Fill(4, 3, 5, 4, TILE_WALL);
+    assert(grid.IsSolid(4, 3) && grid.IsSolid(5, 4) && !grid.IsSolid(3, 3));
+    assert(grid.IsSolid(-1, 0) && grid.IsSolid(0, 8));
+    assert(grid.SolidAt(100 + 4.5f * TILE_SIZE, 50 + 3.5f * TILE_SIZE));
+    assert(!grid.SolidAt(110, 60));
+    assert(grid.SolidAt(90, 60));
     
-    // Verify initial state
-    assert(player.x == 100);
-    assert(player.y == 100);
-    assert(player.health == PLAYER_HEALTH);
-    assert(player.radius == 15);
-    assert(player.color.r == BLUE.r && player.color.g == BLUE.g && player.color.b == BLUE.b);
+    // Sight is blocked through the pillar but not around it
+    assert(!grid.LineClear(1, 3, 8, 4));
+    assert(grid.LineClear(1, 1, 8, 1));
+    assert(grid.LineClear(1, 6, 8, 6));
+    assert(grid.LineClear(3, 3, 3, 3));
     
-    // Test shooting cooldown
-    assert(player.CanShoot() == true);
-    player.ResetShootCooldown();
-    assert(player.CanShoot() == false);
+    // Lines are symmetric
+    for (int y0 = 0; y0 < 8; y0++) {
+        for (int x1 = 0; x1 < 10; x1++) {
+            assert(grid.LineClear(0, y0, x1, 7) == grid.LineClear(x1, 7, 0, y0));
+        }
+    }
     
-    std::cout << "Player test passed!" << std::endl;
+    // A diagonal through the corner between two solid tiles is blocked
+    TileGrid corner;
+    corner.Reset(0, 0, 160, 160);
+    corner.Fill(1, 0, 1, 0, TILE_WALL);
+    corner.Fill(0, 1, 0, 1, TILE_WALL);
+    assert(!corner.LineClear(0, 0, 1, 1));
+    corner.Fill(0, 1, 0, 1, TILE_FLOOR);
+    assert(corner.LineClear(0, 0, 1, 1));
+    
+    // Rays stop at the first solid tile or at the maximum distance
+    float wallX = 100 + 4 * TILE_SIZE;
+    float rayY = 50 + 3.5f * TILE_SIZE;
+    assert(fabs(grid.RayDistance(120, rayY, 1, 0, 1000) - (wallX - 120)) < 0.01f);
+    assert(grid.RayDistance(120, rayY, 1, 0, 50) == 50);
+    assert(fabs(grid.RayDistance(120, rayY, -1, 0, 1000) - 20) < 0.01f);
+    assert(grid.RayDistance(wallX + 1, rayY, 1, 0, 1000) == 0);
+    
+    // Circles are pushed out of walls through the nearest side
+    float px = wallX - 5;
+    float py = rayY;
+    grid.PushOut(px, py, 10);
+    assert(fabs(px - (wallX - 10)) < 0.01f && py == rayY);
+    px = wallX + 2;
+    py = rayY;
+    grid.PushOut(px, py, 10);
+    assert(px <= wallX - 10 + 0.01f);
+    
+    // Walls break after enough damage and only the broken tile is dirty
+    grid.dirty.Clear();
+    bool destroyed = grid.Damage(4, 3, TILE_WALL_HEALTH - 1);
+    assert(!destroyed);
+    assert(grid.IsSolid(4, 3) && grid.dirty.IsEmpty());
+    destroyed = grid.Damage(4, 3, 1);
+    assert(destroyed);
+    assert(!grid.IsSolid(4, 3));
+    assert(grid.dirty.x0 == 4 && grid.dirty.y0 == 3 && grid.dirty.x1 == 4 && grid.dirty.y1 == 3);
+    destroyed = grid.Damage(4, 3, 100);
+    assert(!destroyed);
+    destroyed = grid.Damage(-1, 0, 100) || grid.Damage(0, 0, 100);
+    assert(!destroyed);
+    destroyed = grid.Damage(5, 4, 100);
+    assert(destroyed);
+    assert(grid.dirty.x0 == 4 && grid.dirty.y0 == 3 && grid.dirty.x1 == 5 && grid.dirty.y1 == 4);
+    
+    std::cout << "TileGrid test passed!" << std::endl;
 }
 
-void TestEnemy() {
-    std::cout << "Testing Enemy functionality..." << std::endl;
+void TestFogOfWar() {
+    std::cout << "Testing FogOfWar functionality..." << std::endl;
     
-    // Create RNG
-    std::mt19937 rng(42); // Fixed seed for reproducibility
+    // An open 20x10 room: everything within the sight radius is visible
+    TileGrid grid;
+    grid.Reset(0, 0, 20 * TILE_SIZE, 10 * TILE_SIZE);
+    FogOfWar fog;
+    fog.Reset(grid);
+    assert(fog.wordsPerRow == 1 && !fog.dirty.IsEmpty());
+    fog.dirty.Clear();
+    bool updated = fog.Update(grid, 2, 5);
+    assert(updated);
+    assert(fog.IsVisible(2, 5) && fog.IsVisible(2 + FOG_SIGHT_TILES, 5) && fog.IsVisible(2, 0));
+    assert(!fog.IsVisible(3 + FOG_SIGHT_TILES, 5) && !fog.IsVisible(19, 9));
+    for (int ty = 0; ty < 10; ty++) {
+        for (int tx = 0; tx < 20; tx++) {
+            assert(fog.IsVisible(tx, ty) == fog.IsExplored(tx, ty));
+        }
+    }
+    assert(fog.dirty.x0 == 0 && fog.dirty.x1 == 2 + FOG_SIGHT_TILES && fog.dirty.y0 == 0 && fog.dirty.y1 == 9);
     
-    // Create an enemy
-    Enemy enemy(200, 200, &rng);
+    // Staying on the same tile does no work
+    fog.dirty.Clear();
+    updated = fog.Update(grid, 2, 5);
+    assert(!updated);
+    assert(fog.dirty.IsEmpty());
     
-    // Verify initial state
-    assert(enemy.x == 200);
-    assert(enemy.y == 200);
-    assert(enemy.health == ENEMY_HEALTH);
-    assert(enemy.radius == 12);
-    assert(enemy.color.r == RED.r && enemy.color.g == RED.g && enemy.color.b == RED.b);
+    // A wall hides what is behind it but is visible itself
+    grid.Fill(5, 0, 5, 9, TILE_WALL);
+    fog.Invalidate();
+    updated = fog.Update(grid, 2, 5);
+    assert(updated);
+    assert(fog.IsVisible(5, 5) && fog.IsVisible(4, 5));
+    assert(!fog.IsVisible(6, 5) && !fog.IsVisible(8, 2));
+    assert(fog.IsExplored(8, 2));
+    assert(fog.dirty.x0 == 6 && fog.dirty.x1 == 2 + FOG_SIGHT_TILES);
     
-    // The issue is here - we're assuming enemy.aggro is false initially,
-    // but we should make sure of that
-    assert(enemy.aggro == false); // This should be guaranteed by the constructor
+    // A pillar casts a shadow; the tiles beside the shadow stay visible
+    TileGrid pillar;
+    pillar.Reset(0, 0, 20 * TILE_SIZE, 10 * TILE_SIZE);
+    pillar.Fill(6, 5, 6, 5, TILE_WALL);
+    FogOfWar open;
+    open.Reset(pillar);
+    open.Update(pillar, 3, 5);
+    assert(open.IsVisible(6, 5) && !open.IsVisible(8, 5) && !open.IsVisible(10, 5));
+    assert(open.IsVisible(8, 3) && open.IsVisible(8, 7));
     
-    // Create a player far away (300 units is > 150 aggro range)
-    Player player(500, 500); 
+    // Moving keeps what was explored and marks the changed tiles dirty
+    open.dirty.Clear();
+    open.Update(pillar, 10, 5);
+    assert(open.IsVisible(8, 5) && open.IsExplored(3, 5));
+    assert(!open.IsVisible(0, 5) && open.IsExplored(0, 5));
+    assert(open.dirty.x0 <= 0 && open.dirty.x1 >= 18);
     
-    // Update enemy (player not in aggro range)
-    enemy.Update(0.1f, &player);
-    assert(enemy.aggro == false);
+    std::cout << "FogOfWar test passed!" << std::endl;
+}
+
+void TestLightMap() {
+    std::cout << "Testing LightMap functionality..." << std::endl;
     
-    // Move player closer to trigger aggro (within 150 units)
-    player.x = 220;
-    player.y = 220;
-    enemy.Update(0.1f, &player);
-    assert(enemy.aggro == true);
+    // A 10x8 room with a wall across column 4
+    TileGrid grid;
+    grid.Reset(0, 0, 10 * TILE_SIZE, 8 * TILE_SIZE);
+    grid.Fill(4, 0, 4, 7, TILE_WALL);
+    StaticLight roomLight;
+    LightMap lighting;
+    lighting.Reset(grid, roomLight);
+    assert(lighting.cellsX == 10 * LIGHT_CELLS_PER_TILE && lighting.cellsY == 8 * LIGHT_CELLS_PER_TILE);
+    assert(!lighting.IsBaked() && !lighting.dirty.IsEmpty());
+    assert(lighting.Shade(0, 0) == (unsigned char)LIGHT_SHADE_ALPHA);
     
-    // Test shooting cooldown
-    assert(enemy.CanShoot() == true); // Can shoot when aggro and cooldown 0
-    enemy.ResetShootCooldown();
-    assert(enemy.CanShoot() == false); // Cannot shoot when cooldown > 0
+    // A baked lamp lights its side of the wall only
+    std::vector<LightSource> lamps;
+    lamps.push_back({ 2.5f * TILE_SIZE, 4 * TILE_SIZE, 200, 1.0f });
+    lighting.Bake(grid, lamps);
+    assert(lighting.IsBaked() && roomLight.IsBaked());
+    int lampCellX = 5;
+    int lampCellY = 8;
+    assert(lighting.Level(lampCellX, lampCellY) > 200);
+    assert(lighting.Level(lampCellX, lampCellY) > lighting.Level(1, lampCellY));
+    assert(lighting.Level(6 * LIGHT_CELLS_PER_TILE, lampCellY) == 0);
+    assert(lighting.Level(19, 15) == 0);
+    assert(lighting.Shade(lampCellX, lampCellY) < lighting.Shade(1, lampCellY));
     
-    // Test boss creation
-    Boss boss(400, 400, &rng);
-    assert(boss.health == BOSS_HEALTH);
-    assert(boss.radius == 25);
-    assert(boss.color.r == PURPLE.r && boss.color.g == PURPLE.g && boss.color.b == PURPLE.b);
+    // Dynamic lights only dirty the cells they cover
+    lighting.dirty.Clear();
+    lighting.AddLight({ 7.5f * TILE_SIZE, 5.5f * TILE_SIZE, 60, 1.0f });
+    lighting.UpdateDynamic(grid);
+    assert(lighting.dynamicLight[5 * grid.tilesX + 7] > 0);
+    assert(lighting.Level(7 * LIGHT_CELLS_PER_TILE, 5 * LIGHT_CELLS_PER_TILE) > 0);
+    assert(lighting.dirty.x0 == 6 * LIGHT_CELLS_PER_TILE && lighting.dirty.x1 == 10 * LIGHT_CELLS_PER_TILE - 1);
+    assert(lighting.dirty.y0 == 4 * LIGHT_CELLS_PER_TILE && lighting.dirty.y1 == 8 * LIGHT_CELLS_PER_TILE - 1);
     
-    std::cout << "Enemy test passed!" << std::endl;
+    // Without lights the next frame clears (and dirties) the same area
+    lighting.dirty.Clear();
+    lighting.UpdateDynamic(grid);
+    assert(lighting.dynamicLight[5 * grid.tilesX + 7] == 0);
+    assert(lighting.dirty.x0 == 6 * LIGHT_CELLS_PER_TILE && lighting.dirty.y1 == 8 * LIGHT_CELLS_PER_TILE - 1);
+    lighting.dirty.Clear();
+    lighting.UpdateDynamic(grid);
+    assert(lighting.dirty.IsEmpty());
+    
+    // Past the light limit the weakest lights are dropped
+    for (int i = 0; i < MAX_DYNAMIC_LIGHTS + 5; i++) {
+        lighting.AddLight({ 100, 100, 10.0f + i, 1.0f });
+    }
+    assert(lighting.lightCount == MAX_DYNAMIC_LIGHTS);
+    for (int i = 0; i < lighting.lightCount; i++) {
+        assert(lighting.lights[i].radius >= 15.0f);
+    }
+    lighting.UpdateDynamic(grid);
+    assert(lighting.lightCount == 0);
+    
+    // Breaking the wall only re-bakes the lamp's reach, which now crosses it
+    TileGrid wide;
+    wide.Reset(0, 0, 30 * TILE_SIZE, 8 * TILE_SIZE);
+    wide.Fill(4, 0, 4, 7, TILE_WALL);
+    StaticLight wideLight;
+    LightMap rebaked;
+    rebaked.Reset(wide, wideLight);
+    rebaked.Bake(wide, lamps);
+    std::vector<unsigned char> before = wideLight.cells;
+    rebaked.dirty.Clear();
+    for (int ty = 0; ty < 8; ty++) {
+        wide.Damage(4, ty, TILE_WALL_HEALTH);
+    }
+    rebaked.Rebake(wide, lamps, wide.dirty);
+    assert(rebaked.Level(6 * LIGHT_CELLS_PER_TILE, lampCellY) > 0);
+    assert(rebaked.dirty.x0 == 0 && rebaked.dirty.x1 < 30 * LIGHT_CELLS_PER_TILE - 1);
+    for (int cx = rebaked.dirty.x1 + 1; cx < rebaked.cellsX; cx++) {
+        assert(wideLight.cells[lampCellY * rebaked.cellsX + cx] == before[lampCellY * rebaked.cellsX + cx]);
+    }
+    StaticLight freshLight;
+    LightMap fresh;
+    fresh.Reset(wide, freshLight);
+    fresh.Bake(wide, lamps);
+    assert(freshLight.cells == wideLight.cells);
+    
+    // Changes out of every lamp's reach re-bake nothing
+    rebaked.dirty.Clear();
+    DirtyRect far;
+    far.Add(28, 0, 29, 1);
+    rebaked.Rebake(wide, lamps, far);
+    assert(rebaked.dirty.IsEmpty());
+    
+    // Each room keeps its baked lamps: lighting another room and coming
+    // back needs no bake, only a full upload of the shade texture
+    lighting.Reset(wide, wideLight);
+    assert(lighting.IsBaked());
+    lighting.Reset(grid, roomLight);
+    assert(lighting.IsBaked() && lighting.Level(lampCellX, lampCellY) > 200);
+    assert(lighting.dirty.x0 == 0 && lighting.dirty.x1 == lighting.cellsX - 1 && lighting.dirty.y1 == lighting.cellsY - 1);
+    
+    // A room that was streamed out has to bake its lamps again
+    roomLight.Release();
+    lighting.Reset(grid, roomLight);
+    assert(!lighting.IsBaked() && lighting.Level(lampCellX, lampCellY) == 0);
+    
+    // Flashes fade out and are removed
+    lighting.AddFlash(100, 100, 50, 0.1f);
+    lighting.AddFlash(200, 100, 50, 0.3f);
+    lighting.Update(0.2f);
+    assert(lighting.flashCount == 1 && lighting.flashX[0] == 200);
+    lighting.Update(0.2f);
+    assert(lighting.flashCount == 0);
+    
+    std::cout << "LightMap test passed!" << std::endl;
 }
 
-void TestRoom() {
-    std::cout << "Testing Room functionality..." << std::endl;
+void TestRoomCache() {
+    std::cout << "Testing RoomCache functionality..." << std::endl;
     
-    // Create RNG
-    std::mt19937 rng(42);
+    // A template with a pillar, and a room built from it where the pillar
+    // was damaged and one of its tiles broken
+    TileGrid base;
+    base.Reset(0, 0, 800, 600);
+    base.Fill(5, 5, 7, 6, TILE_WALL);
+    TileGrid grid;
+    grid.Place(base, 800, 600);
+    assert(grid.originX == 800 && grid.tiles == base.tiles && grid.health == base.health);
+    grid.Damage(5, 5, 10);
+    grid.Damage(7, 6, TILE_WALL_HEALTH);
+    TileGrid original = grid;
     
-    // Create a room
-    Room room(0, 0, 800, 600);
+    // Only the two changed tiles are stored
+    RoomCache cache;
+    cache.Store(3, grid, base);
+    assert(cache.entries.size() == 1);
+    assert(cache.entries.front().data.size() == 6);
+    assert(cache.bytes == RoomCache::EntryBytes(cache.entries.front()));
     
-    // Verify initial state
-    assert(room.x == 0);
-    assert(room.y == 0);
-    assert(room.width == 800);
-    assert(room.height == 600);
-    assert(room.cleared == false);
-    assert(room.hasBoss == false);
+    // A room that still matches its template needs no entry
+    TileGrid untouched;
+    untouched.Place(base, 0, 0);
+    cache.Store(4, untouched, base);
+    assert(cache.entries.size() == 1 && cache.lookup.count(4) == 0);
     
-    // Test adding enemies
-    room.AddEnemy(100, 100, &rng);
-    room.AddEnemy(200, 200, &rng);
+    // Restoring over the template's tiles brings the damage back, marks
+    // only the changed tiles dirty and takes the room out of the cache
+    grid.Release();
+    assert(grid.tiles.empty() && grid.tilesX == 0);
+    grid.Place(base, 800, 600);
+    grid.dirty.Clear();
+    bool restored = cache.Restore(3, grid);
+    assert(restored);
+    assert(grid.tiles == original.tiles && grid.health == original.health);
+    assert(grid.health[5 * grid.tilesX + 5] == TILE_WALL_HEALTH - 10);
+    assert(!grid.IsSolid(7, 6));
+    assert(grid.dirty.x0 == 5 && grid.dirty.y0 == 5 && grid.dirty.x1 == 7 && grid.dirty.y1 == 6);
+    assert(cache.entries.empty() && cache.bytes == 0);
+    restored = cache.Restore(3, grid);
+    assert(!restored);
+    
+    // Past the memory cap the least recently stored rooms are dropped
+    TileGrid broken;
+    broken.Place(base, 0, 0);
+    broken.Damage(6, 6, TILE_WALL_HEALTH);
+    cache.capacity = (sizeof(RoomCache::Entry) + 3) * 3;
+    for (int room = 0; room < 5; room++) {
+        cache.Store(room, broken, base);
+        assert(cache.bytes <= cache.capacity);
+    }
+    assert(cache.entries.size() == 3);
+    assert(cache.lookup.count(0) == 0 && cache.lookup.count(1) == 0);
+    assert(cache.entries.front().room == 4 && cache.entries.back().room == 2);
+    
+    // Storing a room again moves it to the front
+    cache.Store(2, broken, base);
+    assert(cache.entries.front().room == 2 && cache.entries.back().room == 3);
+    assert(cache.entries.size() == 3 && cache.lookup.size() == 3);
+    
+    // Storing a room that was repaired to its template drops its entry
+    cache.Store(2, untouched, base);
+    assert(cache.entries.size() == 2 && cache.lookup.count(2) == 0);
+    
+    std::cout << "RoomCache test passed!" << std::endl;
+}
+
+void TestRoomTemplate() {
+    std::cout << "Testing RoomTemplate functionality..." << std::endl;
+    
+    // An empty layout has only floor and a lamp in every corner, placed
+    // relative to the room
+    RoomTemplate empty(800, 600);
+    empty.Layout(0);
+    assert(std::count(empty.tiles.tiles.begin(), empty.tiles.tiles.end(), TILE_WALL) == 0);
+    assert(empty.lamps.size() == 4);
+    assert(empty.lamps[0].x == 200 && empty.lamps[0].y == LAMP_WALL_DISTANCE);
+    assert(empty.lamps[3].x == 600 && empty.lamps[3].y == 600 - LAMP_WALL_DISTANCE);
+    assert(empty.tiles.dirty.IsEmpty());
+    
+    // The same seed always lays out the same pillars, away from the walls
+    // the player enters through, and no lamp stands in a pillar
+    RoomTemplate first(800, 600);
+    RoomTemplate second(800, 600);
+    first.Layout(12345);
+    second.Layout(12345);
+    assert(first.tiles.tiles == second.tiles.tiles);
+    assert(std::count(first.tiles.tiles.begin(), first.tiles.tiles.end(), TILE_WALL) > 0);
+    for (int ty = 0; ty < first.tiles.tilesY; ty++) {
+        for (int tx = 0; tx < first.tiles.tilesX; tx++) {
+            if (tx < 3 || ty < 2 || tx >= first.tiles.tilesX - 3 || ty >= first.tiles.tilesY - 2) {
+                assert(!first.tiles.IsSolid(tx, ty));
+            }
+        }
+    }
+    for (const LightSource& lamp : first.lamps) {
+        assert(!first.tiles.SolidAt(lamp.x, lamp.y));
+    }
+    
+    // Rooms share one template and place its tiles at their own origin;
+    // damage to a room's tiles leaves the template untouched
+    std::shared_ptr<const RoomTemplate> shared = std::make_shared<RoomTemplate>(first);
+    std::shared_ptr<const RoomTemplate> other = shared;
+    assert(shared.use_count() == 2);
+    TileGrid left;
+    TileGrid right;
+    left.Place(shared->tiles, 0, 0);
+    right.Place(other->tiles, 800, 0);
+    int wall = (int)(std::find(left.tiles.begin(), left.tiles.end(), TILE_WALL) - left.tiles.begin());
+    int wallX = wall % left.tilesX;
+    int wallY = wall / left.tilesX;
+    bool destroyed = left.Damage(wallX, wallY, TILE_WALL_HEALTH);
+    assert(destroyed);
+    assert(!left.IsSolid(wallX, wallY));
+    assert(right.IsSolid(wallX, wallY) && shared->tiles.IsSolid(wallX, wallY));
+    assert(right.SolidAt(800 + (wallX + 0.5f) * TILE_SIZE, (wallY + 0.5f) * TILE_SIZE));
+    
+    // Waves belong to each room, so deeper rooms can share a template and
+    // still send more enemies
+    Room shallow(0, 0, shared);
+    Room deep(800, 0, shared);
+    deep.AddWave(6.0f, 4, 0.75f);
+    deep.AddWave(14.0f, 5, 0, FORMATION_LINE);
+    assert(shallow.waves.empty() && deep.waves.size() == 2);
+    assert(deep.waves[0].formation == -1 && deep.waves[1].formation == FORMATION_LINE);
+    assert(deep.width == 800 && deep.layout == shallow.layout);
+    
+    std::cout << "RoomTemplate test passed!" << std::endl;
+}
+
+void TestDungeonGrid() {
+    std::cout << "Testing DungeonGrid functionality..." << std::endl;
+    
+    const int sides[4] = { EXIT_LEFT, EXIT_RIGHT, EXIT_UP, EXIT_DOWN };
+    for (int roomCount = 1; roomCount <= 30; roomCount++) {
+        DungeonGrid grid;
+        grid.Resize(roomCount);
+        
+        // Every room sits on its own grid cell, next to the room before it
+        std::vector<int> cells(roomCount);
+        for (int i = 0; i < roomCount; i++) {
+            cells[i] = grid.Row(i) * grid.columns + grid.Column(i);
+            assert(grid.Column(i) >= 0 && grid.Column(i) < grid.columns);
+            if (i > 0) {
+                assert(abs(grid.Row(i) - grid.Row(i - 1)) + abs(grid.Column(i) - grid.Column(i - 1)) == 1);
+            }
+        }
+        std::sort(cells.begin(), cells.end());
+        assert(std::unique(cells.begin(), cells.end()) == cells.end());
+        
+        // Walk the exits from the first room: every room is entered once,
+        // and the boss room (the last) is only reached after all the others
+        std::vector<bool> entered(roomCount, false);
+        int room = 0;
+        int previous = -1;
+        int steps = 0;
+        entered[0] = true;
+        while (room != roomCount - 1) {
+            int next = -1;
+            for (int s = 0; s < 4; s++) {
+                int neighbour = grid.Neighbour(room, sides[s]);
+                if (neighbour < 0) {
+                    continue;
+                }
+                assert(neighbour == room - 1 || neighbour == room + 1);
+                if (neighbour != previous) {
+                    assert(next < 0);
+                    next = neighbour;
+                }
+            }
+            assert(next >= 0 && !entered[next]);
+            entered[next] = true;
+            previous = room;
+            room = next;
+            steps++;
+        }
+        assert(steps == roomCount - 1);
+        assert(std::count(entered.begin(), entered.end(), true) == roomCount);
+    }
+    
+    // With 5 rooms on 3 columns the boss room lies below the second room,
+    // but the two are not connected
+    DungeonGrid five;
+    five.Resize(5);
+    assert(five.columns == 3);
+    assert(five.Row(4) == 1 && five.Column(4) == 1 && five.Row(1) == 0 && five.Column(1) == 1);
+    assert(five.Neighbour(1, EXIT_DOWN) == -1 && five.Neighbour(4, EXIT_UP) == -1);
+    assert(five.Neighbour(3, EXIT_LEFT) == 4 && five.Neighbour(4, EXIT_RIGHT) == 3);
+    
+    std::cout << "DungeonGrid test passed!" << std::endl;
+}
+
+void TestReplay() {
+    std::cout << "Testing Replay functionality..." << std::endl;
+    
+    const char* fileName = "test_replay.bin";
+    Replay recorded;
+    recorded.Clear(1234);
+    assert(recorded.weaponHash == HashWeaponDefs());
+    for (int i = 0; i < 500; i++) {
+        recorded.Record(1.0f / 60 + i * 0.0001f, (unsigned char)(i * 7));
+    }
+    assert(recorded.TickCount() == 500);
+    assert(recorded.Save(fileName));
+    
+    // A saved replay loads back tick for tick
+    Replay loaded;
+    assert(loaded.Load(fileName));
+    assert(loaded.seed == 1234 && loaded.weaponHash == recorded.weaponHash);
+    assert(loaded.deltaTimes == recorded.deltaTimes);
+    assert(loaded.inputs == recorded.inputs);
+    
+    // Loading again reuses the buffers instead of appending
+    assert(loaded.Load(fileName));
+    assert(loaded.TickCount() == 500);
+    
+    // Replays recorded with another weapon table are rejected, since they
+    // would not re-simulate the same run
+    unsigned int hash = HashWeaponDefs();
+    weaponDefs[WEAPON_SHOTGUN].damage++;
+    assert(HashWeaponDefs() != hash);
+    assert(!loaded.Load(fileName));
+    weaponDefs[WEAPON_SHOTGUN].damage--;
+    assert(HashWeaponDefs() == hash);
+    assert(loaded.Load(fileName));
+    
+    // Read the file back to corrupt its header
+    FILE* file = fopen(fileName, "rb");
+    assert(file != nullptr);
+    std::vector<unsigned char> bytes(20 + 500 * (sizeof(float) + 1));
+    assert(fread(bytes.data(), 1, bytes.size(), file) == bytes.size());
+    fclose(file);
+    auto writeFile = [&](const std::vector<unsigned char>& data) {
+        FILE* out = fopen(fileName, "wb");
+        assert(out != nullptr);
+        fwrite(data.data(), 1, data.size(), out);
+        fclose(out);
+    };
+    
+    // Other versions and other file types are rejected
+    std::vector<unsigned char> corrupt = bytes;
+    corrupt[4]++;
+    writeFile(corrupt);
+    assert(!loaded.Load(fileName));
+    corrupt = bytes;
+    corrupt[0] = 'X';
+    writeFile(corrupt);
+    assert(!loaded.Load(fileName));
+    
+    // A tick count larger than the file holds is rejected before the
+    // buffers are sized, and so is a file cut short
+    corrupt = bytes;
+    unsigned int hugeCount = 0x7fffffffu;
+    memcpy(&corrupt[16], &hugeCount, sizeof(hugeCount));
+    writeFile(corrupt);
+    assert(!loaded.Load(fileName));
+    corrupt = bytes;
+    corrupt.resize(bytes.size() - 1);
+    writeFile(corrupt);
+    assert(!loaded.Load(fileName));
+    
+    remove(fileName);
+    assert(!loaded.Load(fileName));
+    
+    std::cout << "Replay test passed!" << std::endl;
+}
+
+void TestTelemetry() {
+    std::cout << "Testing Telemetry functionality..." << std::endl;
+    
+    // Write one full block and a partial one
+    const char* fileName = "test_telemetry.bin";
+    const int totalRows = TELEMETRY_BLOCK_ROWS + 100;
+    {
+        TelemetryLog log;
+        assert(log.Open(fileName));
+        for (int i = 0; i < totalRows; i++) {
+            TelemetryBlock* row = log.Row();
+            for (int c = 0; c < COL_COUNT; c++) {
+                row->SetInt(c, 0);
+            }
+            row->SetInt(COL_TICK, i);
+            row->SetInt(COL_ROOM, i % 3);
+            row->SetFloat(COL_TICK_US, i * 0.5f);
+            log.Commit();
+        }
+        log.Close();
+    }
+    
+    // Only the wanted columns are decoded, ints and floats alike
+    TelemetryReader reader;
+    assert(reader.Open(fileName));
+    assert((int)reader.names.size() == COL_COUNT);
+    assert(reader.FindColumn("room") == COL_ROOM && reader.isFloat[COL_TICK_US] && !reader.isFloat[COL_ROOM]);
+    assert(reader.FindColumn("missing") == -1);
+    std::vector<bool> wanted(COL_COUNT, false);
+    wanted[COL_TICK] = true;
+    wanted[COL_ROOM] = true;
+    wanted[COL_TICK_US] = true;
+    std::vector<std::vector<float>> values;
+    assert(reader.ReadBlock(wanted, values) == TELEMETRY_BLOCK_ROWS);
+    assert(values[COL_TICK][10] == 10 && values[COL_ROOM][10] == 1 && values[COL_TICK_US][10] == 5.0f);
+    assert(values[COL_ENEMIES].empty());
+    assert(reader.ReadBlock(wanted, values) == 100);
+    assert(values[COL_TICK][99] == totalRows - 1);
+    assert(reader.ReadBlock(wanted, values) == 0);
+    fclose(reader.file);
+    reader.file = nullptr;
+    
+    // Filters are evaluated over a whole column
+    float column[5] = { 1, 2, 3, 4, 5 };
+    unsigned char mask[5];
+    const FilterOp ops[6] = { FILTER_NONE, FILTER_LESS, FILTER_LESS_EQUAL, FILTER_GREATER, FILTER_GREATER_EQUAL, FILTER_EQUAL };
+    const int matches[6] = { 5, 2, 3, 2, 3, 1 };
+    for (int o = 0; o < 6; o++) {
+        ScanFilter(column, 5, ops[o], 3, mask);
+        int count = 0;
+        for (int i = 0; i < 5; i++) {
+            count += mask[i];
+        }
+        assert(count == matches[o]);
+    }
+    ScanFilter(column, 5, FILTER_LESS, 3, mask);
+    assert(mask[0] && mask[1] && !mask[2]);
+    
+    // Only the documented operators parse; typos are rejected
+    FilterOp op = FILTER_NONE;
+    assert(ParseFilterOp(">=", op) && op == FILTER_GREATER_EQUAL);
+    assert(ParseFilterOp("==", op) && op == FILTER_EQUAL);
+    op = FILTER_NONE;
+    assert(!ParseFilterOp("=", op) && !ParseFilterOp("=>", op) && !ParseFilterOp("", op));
+    assert(op == FILTER_NONE);
+    
+    std::vector<float> sample = { 5, 1, 4, 2, 3 };
+    assert(Percentile(sample, 50) == 3 && Percentile(sample, 99) == 5);
+    
+    // Read the file back to corrupt its first block
+    FILE* file = fopen(fileName, "rb");
+    assert(file != nullptr);
+    fseek(file, 0, SEEK_END);
+    std::vector<unsigned char> bytes(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    assert(fread(bytes.data(), 1, bytes.size(), file) == bytes.size());
+    fclose(file);
+    const size_t blockStart = 12 + COL_COUNT * 17;
+    auto readCorrupt = [&](const std::vector<unsigned char>& data) {
+        FILE* out = fopen(fileName, "wb");
+        assert(out != nullptr);
+        fwrite(data.data(), 1, data.size(), out);
+        fclose(out);
+        TelemetryReader corruptReader;
+        assert(corruptReader.Open(fileName));
+        int rows = corruptReader.ReadBlock(wanted, values);
+        while (rows > 0) {
+            rows = corruptReader.ReadBlock(wanted, values);
+        }
+        return rows;
+    };
+    
+    // Row counts and column sizes from the file are checked before use
+    std::vector<unsigned char> corrupt = bytes;
+    int hugeRows = 0x7fffffff;
+    memcpy(&corrupt[blockStart + 4], &hugeRows, sizeof(hugeRows));
+    assert(readCorrupt(corrupt) == -1);
+    corrupt = bytes;
+    int negativeRows = -5;
+    memcpy(&corrupt[blockStart + 4], &negativeRows, sizeof(negativeRows));
+    assert(readCorrupt(corrupt) == -1);
+    corrupt = bytes;
+    int hugeSize = 0x7fffffff;
+    memcpy(&corrupt[blockStart + 8], &hugeSize, sizeof(hugeSize));
+    assert(readCorrupt(corrupt) == -1);
+    
+    // A file cut short reports an error instead of a clean end
+    corrupt = bytes;
+    corrupt.resize(bytes.size() - 10);
+    assert(readCorrupt(corrupt) == -1);
+    assert(readCorrupt(bytes) == 0);
+    
+    remove(fileName);
+    
+    std::cout << "Telemetry test passed!" << std::endl;
+}
+
+void TestDirector() {
+    std::cout << "Testing Director functionality..." << std::endl;
+    
+    // The profiler keeps a rolling window of frame times
+    TickProfiler profiler;
+    assert(profiler.AverageFrameTime() == 0 && profiler.MaxFrameTime() == 0);
+    profiler.RecordFrame(0.01f);
+    profiler.RecordFrame(0.03f);
+    assert(fabs(profiler.AverageFrameTime() - 0.02f) < 1e-6f);
+    assert(profiler.MaxFrameTime() == 0.03f);
+    for (int i = 0; i < PROFILER_WINDOW; i++) {
+        profiler.RecordFrame(0.005f);
+    }
+    assert(fabs(profiler.AverageFrameTime() - 0.005f) < 1e-6f);
+    assert(profiler.MaxFrameTime() == 0.005f);
+    
+    profiler.BeginTick();
+    profiler.Mark(PHASE_PLAYER);
+    profiler.EndTick();
+    assert(profiler.tickCount == 1 && profiler.tickMicros >= 0 && profiler.phaseMicros[PHASE_PLAYER] >= 0);
+    profiler.Reset();
+    assert(profiler.tickCount == 0 && profiler.frameCount == 0);
+    
+    Director director;
+    Player player(400, 300);
+    assert(director.spawnRateScale == 1.0f && director.enemyCap == MAX_ROOM_ENEMIES);
+    assert(director.particleBudget == MAX_PARTICLES);
+    
+    // Decisions are only made every DIRECTOR_INTERVAL seconds, and one
+    // slow evaluation is not enough to shed load
+    auto fillFrames = [&profiler](float seconds) {
+        for (int i = 0; i < PROFILER_WINDOW; i++) {
+            profiler.RecordFrame(seconds);
+        }
+    };
+    fillFrames(FRAME_BUDGET * 2);
+    director.Update(DIRECTOR_INTERVAL * 0.5f, profiler, player);
+    assert(director.overBudgetCount == 0);
+    director.Update(DIRECTOR_INTERVAL * 0.5f, profiler, player);
+    assert(director.overBudgetCount == 1 && director.loadLevel == 0);
+    director.Update(DIRECTOR_INTERVAL, profiler, player);
+    assert(director.loadLevel == 1);
+    assert(director.enemyCap == MAX_ROOM_ENEMIES / 2 && director.particleBudget == MAX_PARTICLES / 4);
+    assert(fabs(director.spawnRateScale - 0.8f) < 1e-6f);
+    
+    // Load never goes past the last step
+    for (int i = 0; i < 20; i++) {
+        director.Update(DIRECTOR_INTERVAL, profiler, player);
+    }
+    assert(director.loadLevel == DIRECTOR_MAX_LOAD);
+    
+    // Frame times just over the budget change nothing either way
+    fillFrames(FRAME_BUDGET * 1.1f);
+    for (int i = 0; i < 20; i++) {
+        director.Update(DIRECTOR_INTERVAL, profiler, player);
+    }
+    assert(director.loadLevel == DIRECTOR_MAX_LOAD);
+    
+    // Load is restored one step at a time after a long stretch within budget
+    fillFrames(FRAME_BUDGET * 0.5f);
+    for (int i = 0; i < 7; i++) {
+        director.Update(DIRECTOR_INTERVAL, profiler, player);
+    }
+    assert(director.loadLevel == DIRECTOR_MAX_LOAD);
+    director.Update(DIRECTOR_INTERVAL, profiler, player);
+    assert(director.loadLevel == DIRECTOR_MAX_LOAD - 1);
+    
+    // An unhurt player gets a harder game, a struggling one an easier game,
+    // within fixed limits
+    director.Reset();
+    for (int i = 0; i < 6; i++) {
+        director.Update(DIRECTOR_INTERVAL, profiler, player);
+    }
+    assert(fabs(director.challenge - 1.1f) < 1e-6f);
+    for (int i = 0; i < 100; i++) {
+        director.Update(DIRECTOR_INTERVAL, profiler, player);
+    }
+    assert(director.challenge == 1.5f);
+    director.ReportDamage(20);
+    director.Update(DIRECTOR_INTERVAL, profiler, player);
+    assert(director.challenge == 1.5f);
+    director.ReportDamage(20);
+    director.Update(DIRECTOR_INTERVAL, profiler, player);
+    assert(fabs(director.challenge - 1.35f) < 1e-5f);
+    player.health = 10;
+    for (int i = 0; i < 100; i++) {
+        director.Update(DIRECTOR_INTERVAL, profiler, player);
+    }
+    assert(fabs(director.challenge - 0.6f) < 1e-6f);
+    assert(fabs(director.fireRateScale - 0.6f) < 1e-6f);
+    
+    // The spawner follows the director: slower waves and a cap on living enemies
+    std::mt19937 rng(7);
+    EnemyPool pool;
+    SquadPool squadPool;
+    pool.Preallocate(32, &rng);
+    Room room(0, 0, std::make_shared<const RoomTemplate>(800.0f, 600.0f));
+    room.AddWave(0.0f, 10, 1.0f);
+    room.UpdateWaves(2.0f, pool, squadPool, rng, 0.5f, 3);
     assert(room.enemies.size() == 2);
+    room.UpdateWaves(20.0f, pool, squadPool, rng, 0.5f, 3);
+    assert(room.enemies.size() == 3 && !room.WavesFinished());
+    room.enemies[0]->active = false;
+    room.UpdateWaves(0.0f, pool, squadPool, rng, 0.5f, 3);
+    assert(room.enemies.size() == 3);
+    int active = 0;
+    for (const auto& enemy : room.enemies) {
+        active += enemy->active;
+    }
+    assert(active == 3);
+    room.ReleaseEnemies(pool, squadPool);
     
-    // Test point containment
-    assert(room.ContainsPoint(100, 100) == true);
-    assert(room.ContainsPoint(900, 100) == false);
+    std::cout << "Director test passed!" << std::endl;
+}
+
+void TestQualityManager() {
+    std::cout << "Testing QualityManager functionality..." << std::endl;
     
-    // Test room clearing
-    for (auto& enemy : room.enemies) {
-        enemy->active = false;
+    TickProfiler profiler;
+    QualityManager quality;
+    auto fillFrames = [&profiler](float seconds) {
+        for (int i = 0; i < PROFILER_WINDOW; i++) {
+            profiler.RecordFrame(seconds);
+        }
+    };
+    auto run = [&quality, &profiler](float seconds) {
+        for (float t = 0; t < seconds - 0.01f; t += 0.25f) {
+            quality.Update(0.25f, profiler);
+        }
+    };
+    
+    // Full quality by default
+    assert(quality.level == 0);
+    assert(quality.CircleSegments() == 36 && quality.OffFocusHealthBars());
+    assert(quality.AILodDistance() == INFINITY);
+    assert(quality.ParticleBudget(MAX_PARTICLES) == MAX_PARTICLES);
+    assert(quality.ParticleBudget(100) == 100);
+    
+    // Degrades one level after a second over budget, not before
+    fillFrames(FRAME_BUDGET * 1.5f);
+    run(0.75f);
+    assert(quality.level == 0);
+    run(0.25f);
+    assert(quality.level == 1);
+    assert(quality.CircleSegments() == 24 && !quality.OffFocusHealthBars());
+    assert(quality.AILodDistance() == 600.0f);
+    assert(quality.ParticleBudget(MAX_PARTICLES) == MAX_PARTICLES / 2);
+    
+    // Stops at the lowest level, which drops particles entirely
+    run(10.0f);
+    assert(quality.level == QUALITY_LEVELS - 1);
+    assert(quality.ParticleBudget(MAX_PARTICLES) == 0 && quality.CircleSegments() == 10);
+    
+    // Frames just over the budget neither degrade nor restore
+    fillFrames(FRAME_BUDGET * 1.05f);
+    run(10.0f);
+    assert(quality.level == QUALITY_LEVELS - 1);
+    
+    // Restores one level after three seconds within budget, and a single
+    // slow check in between starts the count again
+    fillFrames(FRAME_BUDGET * 0.5f);
+    run(2.75f);
+    assert(quality.level == QUALITY_LEVELS - 1);
+    fillFrames(FRAME_BUDGET * 1.5f);
+    run(0.25f);
+    fillFrames(FRAME_BUDGET * 0.5f);
+    run(2.75f);
+    assert(quality.level == QUALITY_LEVELS - 1);
+    run(0.25f);
+    assert(quality.level == QUALITY_LEVELS - 2);
+    run(30.0f);
+    assert(quality.level == 0);
+    
+    quality.level = 2;
+    quality.Reset();
+    assert(quality.level == 0 && quality.timer == 0);
+    
+    std::cout << "QualityManager test passed!" << std::endl;
+}
+
+void TestIdleRedraw() {
+    std::cout << "Testing idle redraw functionality..." << std::endl;
+    
+    SceneManager scenes;
+    RecordingScene menu;
+    RecordingScene gameplay(false);
+    
+    // A static screen is drawn once when it appears and then sleeps
+    scenes.Push(&menu);
+    assert(scenes.IsStatic() && scenes.NeedsRedraw());
+    scenes.Update();
+    scenes.Draw();
+    assert(menu.draws == 1);
+    for (int frame = 0; frame < 10; frame++) {
+        scenes.Update();
+        assert(!scenes.NeedsRedraw());
     }
+    assert(menu.updates == 11);
     
-    // Create a player for room update
+    // Restoring the window asks for one more frame
+    scenes.RequestRedraw();
+    assert(scenes.NeedsRedraw());
+    scenes.Draw();
+    assert(!scenes.NeedsRedraw());
+    
+    // Gameplay redraws every frame
+    scenes.Replace(&gameplay);
+    for (int frame = 0; frame < 10; frame++) {
+        scenes.Update();
+        assert(!scenes.IsStatic() && scenes.NeedsRedraw());
+        scenes.Draw();
+    }
+    assert(gameplay.draws == 10 && menu.draws == 2);
+    
+    // Back on a static screen it sleeps again after one frame
+    scenes.Replace(&menu);
+    assert(scenes.NeedsRedraw());
+    scenes.Draw();
+    assert(!scenes.NeedsRedraw());
+    
+    // An empty stack has nothing to animate
+    SceneManager empty;
+    empty.Update();
+    assert(empty.IsStatic());
+    
+    std::cout << "Idle redraw test passed!" << std::endl;
+}
+
+void TestDungeonReset() {
+    std::cout << "Testing Dungeon reset functionality..." << std::endl;
+    
+    // Positions, directions and waves of every room, to compare builds
+    auto snapshot = [](const Dungeon& dungeon) {
+        std::vector<float> values;
+        for (const Room& room : dungeon.rooms) {
+            values.push_back(room.x);
+            values.push_back(room.y);
+            values.push_back((float)room.exits);
+            values.push_back((float)room.waves.size());
+            values.push_back((float)room.swarmSize);
+            for (const auto& enemy : room.enemies) {
+                values.push_back(enemy->x);
+                values.push_back(enemy->y);
+                values.push_back(enemy->speedX);
+                values.push_back(enemy->IsBoss() ? 1.0f : 0.0f);
+            }
+        }
+        return values;
+    };
+    
+    Dungeon dungeon;
+    dungeon.Build(11, 200);
+    std::vector<float> first = snapshot(dungeon);
+    const Room* roomStorage = dungeon.rooms.data();
+    Enemy* boss = dungeon.rooms.back().enemies[0].get();
+    assert(boss->IsBoss());
+    int allocated = dungeon.enemyPool.allocated;
+    size_t pooled = dungeon.enemyPool.available.size();
+    
+    // Play a little: kill enemies and start the waves in a few rooms (the
+    // streamer builds a room's tiles before it is updated)
     Player player(400, 300);
+    for (int i = 1; i < 5; i++) {
+        Room& room = dungeon.rooms[i];
+        room.BuildTiles();
+        room.enemies[0]->TakeDamage(1000);
+        room.UpdateWaves(20.0f, dungeon.enemyPool, dungeon.squadPool, dungeon.rng);
+        room.Update(0.1f, &player);
+    }
     
-    // Update room
-    room.Update(0.1f, &player);
+    // Another seed builds another run in the same storage
+    dungeon.Build(12, 200);
+    assert(snapshot(dungeon) != first);
+    assert(dungeon.rooms.data() == roomStorage);
     
-    // Room should be cleared now
-    assert(room.cleared == true);
+    // The same seed builds the same run again, with the same enemies and
+    // boss and without allocating any
+    dungeon.Build(11, 200);
+    assert(snapshot(dungeon) == first);
+    assert(dungeon.rooms.data() == roomStorage);
+    assert(dungeon.rooms.back().enemies[0].get() == boss);
+    assert(boss->active && boss->health == BOSS_HEALTH);
+    assert(dungeon.enemyPool.allocated == allocated);
+    assert(dungeon.enemyPool.available.size() == pooled);
+    assert(dungeon.squadPool.allocated == SQUAD_POOL_SIZE);
+    for (const Room& room : dungeon.rooms) {
+        assert(!room.cleared && room.waveIndex == 0 && room.waveTime == 0 && !room.squads);
+        for (const auto& enemy : room.enemies) {
+            assert(enemy->active && enemy->rng == &dungeon.rng);
+        }
+    }
     
-    std::cout << "Room test passed!" << std::endl;
-}
\ No newline at end of file
+    // A smaller dungeon gives every enemy of the removed rooms back
+    dungeon.Build(11, 5);
+    assert(dungeon.rooms.size() == 5);
+    assert(dungeon.enemyPool.allocated == allocated);
+    int lent = 0;
+    for (const Room& room : dungeon.rooms) {
+        for (const auto& enemy : room.enemies) {
+            lent += !enemy->IsBoss();
+        }
+    }
+    assert(lent + (int)dungeon.enemyPool.available.size() == allocated);
+    
+    std::cout << "Dungeon reset test passed!" << std::endl;
+}
+
+void TestPregeneration() {
+    std::cout << "Testing pregeneration functionality..." << std::endl;
+    
+    // Enemy positions of every room, to compare builds
+    auto snapshot = [](const Dungeon& dungeon) {
+        std::vector<float> values;
+        for (const Room& room : dungeon.rooms) {
+            values.push_back(room.x);
+            values.push_back(room.y);
+            for (const auto& enemy : room.enemies) {
+                values.push_back(enemy->x);
+                values.push_back(enemy->y);
+                values.push_back(enemy->speedX);
+            }
+        }
+        return values;
+    };
+    
+    // Reference build on this thread
+    Dungeon reference;
+    reference.Build(99, 50);
+    std::vector<float> expected = snapshot(reference);
+    
+    // Build the next run on a worker while the current one keeps playing,
+    // as the game does during the game over screen
+    Dungeon dungeons[2];
+    Dungeon* current = &dungeons[0];
+    Dungeon* next = &dungeons[1];
+    current->Build(5, 50);
+    std::vector<float> before = snapshot(*current);
+    next->Build(7, 50);
+    
+    std::atomic<bool> ready(false);
+    std::thread worker([next, &ready]() {
+        next->Build(99, 50);
+        ready = true;
+    });
+    Room& room = current->rooms[0];
+    for (int i = 0; i < 100; i++) {
+        room.SpawnEnemy(400, 300, current->enemyPool);
+    }
+    room.ReleaseEnemies(current->enemyPool, current->squadPool);
+    worker.join();
+    assert(ready);
+    
+    // The worker's build matches one made on the main thread, uses only its
+    // own dungeon's RNG, and swapping it in is just a pointer swap
+    assert(snapshot(*next) == expected);
+    for (const Room& nextRoom : next->rooms) {
+        for (const auto& enemy : nextRoom.enemies) {
+            assert(enemy->rng == &next->rng);
+        }
+    }
+    std::swap(current, next);
+    assert(current == &dungeons[1] && current->seed == 99);
+    
+    // The run that was being played is rebuilt in place for the run after
+    next->Build(5, 50);
+    assert(snapshot(*next) == before);
+    
+    std::cout << "Pregeneration test passed!" << std::endl;
+}
+
+void TestSceneStack() {
+    std::cout << "Testing scene stack functionality..." << std::endl;
+    
+    SceneManager scenes;
+    RecordingScene menu;
+    RecordingScene gameplay(false);
+    RecordingScene pause(true, true);
+    RecordingScene gameOver;
+    RecordingScene loading(false);
+    scenes.SetLoadingScene(&loading);
+    scenes.Push(&menu);
+    assert(menu.enters == 1 && menu.manager == &scenes);
+    
+    // A ready scene is switched to directly
+    scenes.SwitchTo(&gameplay);
+    assert(menu.exits == 1 && gameplay.enters == 1 && loading.enters == 0);
+    
+    // Pausing suspends gameplay without tearing it down; only the top scene
+    // is updated, but the game stays visible under the overlay
+    scenes.Push(&pause);
+    assert(gameplay.suspends == 1 && gameplay.exits == 0 && pause.enters == 1);
+    scenes.Update();
+    scenes.Update();
+    assert(pause.updates == 2 && gameplay.updates == 0);
+    scenes.Draw();
+    assert(pause.draws == 1 && gameplay.draws == 1);
+    scenes.Pop();
+    assert(pause.exits == 1 && gameplay.resumes == 1);
+    scenes.Update();
+    assert(gameplay.updates == 1);
+    
+    // Covered scenes that are not below an overlay are not drawn
+    scenes.Replace(&gameOver);
+    scenes.Push(&menu);
+    scenes.Draw();
+    assert(menu.draws == 1 && gameOver.draws == 0);
+    scenes.Pop();
+    
+    // A scene that is still preloading is shown through the loading scene,
+    // which switches as soon as it is ready
+    gameplay.loaded = false;
+    gameplay.StartPreload();
+    int gameplayEnters = gameplay.enters;
+    scenes.SwitchTo(&gameplay);
+    assert(loading.enters == 1 && gameplay.enters == gameplayEnters);
+    scenes.FinishLoading();
+    assert(gameplay.enters == gameplayEnters);
+    gameplay.loaded = true;
+    scenes.FinishLoading();
+    assert(loading.exits == 1 && gameplay.enters == gameplayEnters + 1);
+    scenes.FinishLoading();
+    assert(gameplay.enters == gameplayEnters + 1 && gameplay.preloads == 1);
+    
+    // Popping the last scene leaves an empty stack that ignores further pops
+    scenes.Pop();
+    scenes.Pop();
+    scenes.Update();
+    assert(gameplay.exits == 2);
+    
+    std::cout << "Scene stack test passed!" << std::endl;
+}